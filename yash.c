@@ -5,6 +5,7 @@
  *It implements a subset of features supported by a standard shell like bash/zsh.
  **/
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <readline/readline.h>
 #include <readline/history.h>
@@ -13,10 +14,26 @@
 #include <string.h>
 #include <stdlib.h>
 #include <sys/wait.h>
+#include <sys/time.h>
+#include <sys/resource.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <signal.h>
 #include <stdbool.h>
+#include <spawn.h>
+#include <errno.h>
+#include <ctype.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/signalfd.h>
+#include <sys/mman.h>
+#include <limits.h>
+#include <dirent.h>
+#include <sys/syscall.h>
+#include <sched.h>
+#if defined(__x86_64__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
 
 #define fg 1
 #define bg 0
@@ -24,840 +41,8493 @@
 typedef enum
 {
     RUNNING,
-    STOPPED
+    STOPPED,
+    DONE
 } JobStatus;
 
+typedef enum
+{
+    TOKEN_WORD,
+    TOKEN_PIPE,
+    TOKEN_AMP,
+    TOKEN_SEMI,
+    TOKEN_AND_IF,
+    TOKEN_OR_IF,
+    TOKEN_LESS,
+    TOKEN_DLESS,
+    TOKEN_DLESSDASH,
+    TOKEN_TLESS,
+    TOKEN_GREAT,
+    TOKEN_DGREAT,
+    TOKEN_LPAREN,
+    TOKEN_RPAREN,
+    TOKEN_NEWLINE,
+    TOKEN_END
+} TokenType;
+
+typedef enum
+{
+    TRACE_LINE_READ,
+    TRACE_PARSE_DONE,
+    TRACE_PARSE_CACHED,
+    TRACE_SPAWN,
+    TRACE_FORK,
+    TRACE_TERMINAL,
+    TRACE_WAIT_BEGIN,
+    TRACE_WAIT_END,
+    TRACE_STOP,
+    TRACE_CONTINUE,
+    TRACE_REAP,
+    TRACE_JOB_ADD,
+    TRACE_JOB_STATE,
+    TRACE_JOB_REMOVE,
+    TRACE_EXEC
+} TraceEventType;
+
+typedef enum
+{
+    NODE_PIPELINE,
+    NODE_AND,
+    NODE_OR,
+    NODE_SEQUENCE,
+    NODE_BACKGROUND,
+    NODE_IF,
+    NODE_WHILE,
+    NODE_UNTIL,
+    NODE_FOR
+} NodeType;
+
+#define PATH_CACHE_MIN_BUCKETS 64
+#define PID_TABLE_MIN_BUCKETS 64
+#define JOB_TABLE_MIN_SIZE 16
+#define DONE_JOBS_KEPT 1024
+#define TIMEOUT_KILL_AFTER 5.0
+#define PLACEMENT_MAX_LIMITS 16
+#define IOPRIO_CLASS_SHIFT 13
+#define IOPRIO_WHO_PROCESS 1
+#define ARENA_BLOCK_SIZE 8192
+#define ARENA_ALIGN 16
+#define DEFAULT_PATH "/bin:/usr/bin"
+#define SCRIPT_READ_SIZE 65536
+#define TRACE_RING_SIZE 4096
+#define AST_CACHE_BUCKETS 256
+#define AST_CACHE_MAX_ENTRIES 512
+#define INPUT_INCOMPLETE -1
+#define HISTORY_INDEX_MIN_SIZE 1024
+#define TEXT_BUFFER_MIN_SIZE 256
+#define VARIABLE_TABLE_MIN_BUCKETS 128
+#define SUBSTITUTION_READ_SIZE 16384
+#define PARALLEL_MAX_FAILURES 101
+#define XARGS_HEADROOM 2048
+#define HISTORY_SEARCH_WINDOW 65536
+#define DIRECTORY_CACHE_BUCKETS 64
+#define DIRENT_BUFFER_SIZE 262144
+
+// records a trace event; with tracing off this is a single test of traceEnabled
+#define TRACE(type, pid, pgid, job, value)                                                                              \
+    do                                                                                                                 \
+    {                                                                                                                  \
+        if (traceEnabled)                                                                                              \
+        {                                                                                                              \
+            recordTraceEvent(type, pid, pgid, job, value);                                                             \
+        }                                                                                                              \
+    } while (0)
+
 struct processList
 {
     char *processString;
     int groupId;
     pid_t cpid;
     char *inputPath;
+    char *inputText;
+    char **assignments;
+    char **environment;
     char *outputPath;
+    bool appendOutput;
     char **processArgs;
+    int status;
+    bool completed;
+    bool stopped;
+    struct rusage usage;
+    struct astNode *compound;
+    int pidFd;     // pidfd of a job stage that is still running, -1 if there is none
+    bool ownGroup; // the stage gets a process group of its own even without job control
+    struct placement *placement;
     struct processList *next;
 };
 
-struct jobList
+struct job
 {
     int jobId;
     char *jobCommand;
     int jobCount;
-    char *jobSign;
     JobStatus jobStatus;
     struct processList *process;
-    struct jobList *next;
+    struct job *mruPrev;
+    struct job *mruNext;
+    struct job *doneNext;
+    pid_t owner; // the shell process that started the job, a forked copy inherits the jobs of its parent
+};
+
+struct arenaBlock
+{
+    struct arenaBlock *next;
+    size_t size;
+    size_t used;
+    _Alignas(ARENA_ALIGN) char data[];
+};
+
+struct arena
+{
+    struct arenaBlock *first;
+    struct arenaBlock *last;
+    struct arenaBlock *current;
+};
+
+struct arenaMark
+{
+    struct arenaBlock *block;
+    size_t used;
+};
+
+struct pidEntry
+{
+    pid_t pid;
+    struct job *job;
+    struct processList *process;
+    struct pidEntry *next;
+};
+
+struct signalName
+{
+    const char *name;
+    int number;
+};
+
+struct limitName
+{
+    const char *name;
+    int resource;
+};
+
+// where a job runs and what it may use, set with jobctl
+struct placement
+{
+    bool setAffinity;
+    cpu_set_t cpus;
+    bool setNice;
+    int nice;
+    int ioprio; // class << IOPRIO_CLASS_SHIFT | level, or -1
+    int limitCount;
+    int resources[PLACEMENT_MAX_LIMITS];
+    rlim_t limits[PLACEMENT_MAX_LIMITS];
+};
+
+// a << or <<- token is resolved to the slice of its here-document body once the tokenizer has read it
+struct token
+{
+    TokenType type;
+    int offset;
+    int length;
+    bool quoted;
+    bool expand;
+};
+
+struct stage
+{
+    char **args;
+    char *inputPath;
+    char *inputText;
+    char *hereString;
+    bool expandInput;
+    char *outputPath;
+    bool appendOutput;
+    char **assignments;
+    bool expand;
+    struct astNode *compound;
+    struct stage *next;
+};
+
+struct astNode
+{
+    NodeType type;
+    struct astNode *left;
+    struct astNode *right;
+    struct astNode *elseBranch;
+    struct stage *stages;
+    bool timed;
+    char *text;
+    char *name;
+    char **words;
+    int wordCount;
+    bool expand;
+};
+
+struct parser
+{
+    const char *source;
+    char *line;
+    struct token *tokens;
+    int pos;
+    struct arena *arena;
+    bool failed;
+    bool incomplete;
+};
+
+struct astCacheEntry
+{
+    char *source;
+    unsigned int hash;
+    struct astNode *ast;
+    struct astCacheEntry *next;
+};
+
+struct variable
+{
+    char *entry; // NAME=value, which is also the string in the environment when exported
+    size_t nameLength;
+    unsigned int hash;
+    bool exported;
+    int envIndex;
+    struct variable *next;
+};
+
+struct textBuffer
+{
+    char *data;
+    size_t length;
+    size_t capacity;
+};
+
+// a command run by the parallel builtin, with the memfd its output is collected in
+struct parallelTask
+{
+    char *command;
+    struct job *job;
+    int outputFd;
+    struct textBuffer output; // the output of a finished task that waits for its turn with -k
+    int status;
+    bool finished;
+};
+
+// the fields a word expands to, and the one being built
+struct fieldList
+{
+    char **words;
+    int count;
+    int capacity;
+    struct textBuffer field;
+    struct textBuffer pattern; // the field with the characters that must match literally escaped
+    bool glob;
+    bool started;
+};
+
+// the entries of a directory read for pathname expansion. The names are packed in one block, each one behind its
+// d_type byte and ended by a NUL, so a listing costs no allocation per entry
+struct directoryListing
+{
+    char *path;
+    struct timespec mtime;
+    struct timespec scanned;
+    char *names;
+    size_t size;
+    size_t capacity;
+    int count;
+    unsigned int hash;
+    struct directoryListing *next;
+};
+
+// what getdents64 fills its buffer with
+struct linuxDirent64
+{
+    ino64_t d_ino;
+    off64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+struct traceEvent
+{
+    long long time;
+    TraceEventType type;
+    pid_t pid;
+    pid_t pgid;
+    int job;
+    long value;
+};
+
+typedef int (*builtinHandler)(char **args);
+
+// a pure builtin leaves the state of the shell alone, so a command substitution may run it in the shell itself
+struct builtin
+{
+    const char *name;
+    builtinHandler handler;
+    bool pure;
+};
+
+struct testState
+{
+    char **args;
+    int count;
+    int pos;
+    bool error;
+};
+
+struct pathCacheEntry
+{
+    char *commandName;
+    char *commandPath;
+    int hits;
+    struct pathCacheEntry *next;
 };
 
-struct jobList *deleteJobByPid(struct jobList **headRef, int pid);
-int *getPidList(struct jobList **headRef);
+void *arenaAlloc(struct arena *arena, size_t size);
+char *arenaStrdup(struct arena *arena, const char *str);
+void arenaReset(struct arena *arena);
+struct arenaMark arenaSave(struct arena *arena);
+void arenaRestore(struct arena *arena, struct arenaMark mark);
+struct processList *copyProcessList(struct processList *rootProcess);
+void freeProcessList(struct processList *rootProcess);
 const char *getJobsStatus(JobStatus jobStatus);
-bool search(struct jobList **headRef, int pid);
-void printdone(struct jobList *root);
-struct jobList *newNode(int jobId, char *jobCommand, JobStatus jobStatus, int jobCount, struct processList *process);
-void pushJob(struct jobList **root, int jobId, char *jobCommand, JobStatus jobStatus, int jobCount, struct processList *process);
-struct jobList *popJob(struct jobList **root);
-void printJobs(struct jobList *root);
-struct jobList *deleteJobByStatus(struct jobList **headRef, JobStatus jobStatus);
-int checkIfShellCommands(char *inString);
-char **parseStringStrtok(char *str, char *delim);
-struct processList *parseSubCommand(char **subCommand);
-struct processList *parseStringforPipes(char **parsedCmdArray);
-int exexuteCommands(struct processList *rootProcess, int infd, int outfd, int job_type);
+void printdone(struct job *root);
+struct pidEntry *findPid(pid_t pid);
+void registerPid(pid_t pid, struct job *job, struct processList *process);
+void unregisterPid(pid_t pid);
+void touchJob(struct job *job);
+struct job *addJob(struct processList *rootProcess, JobStatus jobStatus);
+void removeJob(struct job *job);
+struct job *findJobByNumber(int jobCount);
+const char *getJobSign(struct job *job);
+struct job *parseJobSpec(const char *spec, const char *builtinName);
+void printJob(struct job *job);
+int foregroundJob(char **args);
+int backgroundJob(char **args);
+struct job *waitForJobs(struct job **jobs, int count, bool any);
+int getJobStatus(struct job *job);
+int waitCommand(char **args);
+bool parseDuration(const char *text, double *seconds);
+int timeoutCommand(char **args);
+char *joinArgs(char **args);
+bool parseCpuList(const char *text, cpu_set_t *cpus);
+bool parseIoPriority(const char *text, int *ioprio);
+bool parseLimit(const char *text, struct placement *placement);
+bool applyPlacement(pid_t pid, struct placement *placement);
+int jobControlCommand(char **args);
+void signalJob(struct job *job, int sig);
+char *nextTaskCommand(char **args, int *argIndex, struct textBuffer *input, size_t *inputStart, bool *inputEnd);
+struct job *startTask(struct parallelTask *task, bool capture, bool nullInput);
+void spoolTaskOutput(struct parallelTask *task);
+void printTaskOutput(struct parallelTask *task);
+int parallelCommand(char **args);
+size_t environmentSize();
+struct job *startBatch(char **command, int commandCount, char *commandPath, char *items, size_t length, int itemCount,
+                       int inputFd);
+bool finishBatch(struct job **running, int *runningCount, int *status);
+int xargsCommand(char **args);
+int listJobs(char **args);
+double timevalSeconds(struct timeval tv);
+void addUsage(struct rusage *total, const struct rusage *usage);
+bool readLiveUsage(pid_t pid, struct rusage *usage);
+void printJobUsage(struct job *job);
+void printTimeReport(double real, const struct rusage *usage);
+int getSignalNumber(const char *name);
+int killCommand(char **args);
+int exitCommand(char **args);
+int changeDirectory(char **args);
+int printWorkingDirectory(char **args);
+int echoCommand(char **args);
+int trueCommand(char **args);
+int falseCommand(char **args);
+bool isUnaryTest(const char *op);
+bool isBinaryTest(const char *op);
+long testInteger(struct testState *state, const char *arg);
+bool testUnary(struct testState *state, char op, const char *arg);
+bool testBinary(struct testState *state, const char *left, const char *op, const char *right);
+bool testPrimary(struct testState *state);
+bool testNot(struct testState *state);
+bool testAnd(struct testState *state);
+bool testOr(struct testState *state);
+int testCommand(char **args);
+bool isValidName(const char *name, size_t length);
+int exportCommand(char **args);
+int unsetCommand(char **args);
+int compareBuiltin(const void *name, const void *entry);
+struct builtin *findBuiltin(const char *name);
+int runBuiltin(struct builtin *builtin, struct processList *process);
+void initMetachars();
+const char *getTraceEventName(TraceEventType type);
+void recordTraceEvent(TraceEventType type, pid_t pid, pid_t pgid, int job, long value);
+void flushTrace();
+void flushTraceAtExit();
+bool setTracing(bool enable);
+int setCommand(char **args);
+size_t findMetacharScalar(const char *str, size_t index, size_t length);
+size_t findMetacharSse2(const char *str, size_t index, size_t length);
+size_t findMetacharAvx2(const char *str, size_t index, size_t length);
+const char *getTokenText(TokenType type);
+struct token *unterminatedQuote(char quote, int *tokenCount, bool final);
+bool readHereDocuments(const char *line, struct token *tokens, int first, int last, size_t *index, bool final);
+struct token *tokenizeLine(const char *line, int *tokenCount, bool final);
+char *rawWord(char *line, struct token *token);
+char *materializeWord(char *line, struct token *token);
+char *stageWord(struct parser *parser, struct stage *stage);
+void syntaxError(const char *source, struct token *token);
+bool isRedirection(TokenType type);
+char *copyHereDocument(struct parser *parser, struct token *token);
+bool isWord(struct parser *parser, const char *word);
+bool isListTerminator(struct parser *parser);
+struct astNode *parseFailure(struct parser *parser);
+bool expectWord(struct parser *parser, const char *word);
+void skipNewlines(struct parser *parser);
+struct astNode *newNode(struct parser *parser, NodeType type);
+char *copySourceText(struct parser *parser, int start, int end);
+struct astNode *parseList(struct parser *parser);
+struct astNode *parseRequiredList(struct parser *parser);
+struct astNode *parseAndOr(struct parser *parser);
+struct astNode *parsePipelineNode(struct parser *parser);
+struct stage *parseStage(struct parser *parser);
+bool isAssignment(const char *source, struct token *token);
+struct astNode *parseIf(struct parser *parser);
+struct astNode *parseLoop(struct parser *parser);
+struct astNode *parseFor(struct parser *parser);
+void clearAstCache();
+struct astNode *parseSource(const char *source, bool final, int *result);
+int exexuteCommands(struct processList *rootProcess, int infd, int outfd);
+int openHereDocument(const char *text);
+int openInputRedirection(struct processList *process);
 int executeParsedCommand(struct processList *rootProcess, int job_type);
-void executeShellCommands(char *inString);
-char **parsecommands(char *inString);
-void sigChildHandler(int signo);
-int isEmpty(struct jobList *root);
-void checkPrevJobCount(struct jobList **temp);
-void assigbJobSign(struct jobList **jobRef);
-int getProcessCount();
-
-struct jobList *rootJob = NULL;
+void appendText(struct textBuffer *buffer, const char *text, size_t length);
+void appendField(struct fieldList *fields, const char *text, size_t length, bool quoted);
+void addField(struct fieldList *fields, char *word);
+void endField(struct fieldList *fields);
+bool hasGlobChar(const char *text, size_t length);
+const char *findBracketEnd(const char *pattern);
+bool matchBracket(const char *start, const char *end, char c);
+bool matchChar(const char **pattern, char c);
+bool matchPattern(const char *pattern, const char *name);
+struct directoryListing *readDirectory(const char *path);
+void clearDirectoryCache();
+bool isDirectoryEntry(struct textBuffer *path, const char *name, unsigned char type, bool follow);
+void globPath(struct textBuffer *path, char **components, int index, int count, struct fieldList *fields);
+int compareFields(const void *a, const void *b);
+int expandPattern(const char *pattern, struct fieldList *fields);
+void appendSubstitution(struct fieldList *fields, const char *text, size_t length, bool split);
+char *commandSubstitution(const char *command, size_t *length);
+char *trimSubstitution(struct textBuffer *output, size_t *length);
+size_t skipExpansion(const char *text, size_t index, size_t length, bool *expand);
+char getClosingChar(const char *text, size_t index);
+size_t skipSubstitution(const char *text, size_t index, size_t length);
+size_t skipBackquote(const char *text, size_t index, size_t length);
+size_t expandSubstitution(const char *text, size_t index, size_t length, struct fieldList *fields, bool split);
+size_t expandParameter(const char *text, size_t index, size_t length, struct fieldList *fields, bool split);
+size_t expandDollar(const char *text, size_t index, size_t length, struct fieldList *fields, bool split);
+void expandWord(const char *word, struct fieldList *fields, bool split);
+char *expandHereDocument(const char *text);
+char **expandWords(char **words, int *count);
+char *expandSingleWord(const char *word);
+bool listAborted();
+bool endLoop();
+void assignVariables(char **assignments);
+void expandStage(struct stage *stage, struct processList *process);
+int runPipelineNode(struct astNode *node, int job_type);
+int runBackgroundNode(struct astNode *node);
+int runLoop(struct astNode *node);
+int runFor(struct astNode *node);
+int executeNode(struct astNode *node);
+int breakCommand(char **args);
+int continueCommand(char **args);
+int parsecommands(char *inString, bool final);
+int runParsedCommands(struct astNode *ast, int result);
+void reapChildren();
+void updateProcessStatus(pid_t pid, int status, struct rusage *usage);
+void notifyDoneJobs(bool print);
+void trimDoneJobs();
+void collectJob(struct job *job);
+int openPidFd(pid_t pid);
+void openHistory();
+bool refreshHistory();
+void addHistory(const char *text);
+size_t findHistoryEntry(size_t offset);
+void showHistoryEntry(size_t entry, size_t point);
+int historyPrevious(int count, int key);
+int historyNext(int count, int key);
+int historySearchBackward(int count, int key);
+bool commandIndexStale(const char *path);
+void buildCommandIndex(const char *path);
+bool isCommandPosition(int start);
+char *completeCommand(const char *text, int state);
+char *completeJob(const char *text, int state);
+char **completeWord(const char *text, int start, int end);
+void handleLine(char *inString);
+size_t runScriptText(const char *text, size_t length, bool final);
+int runScriptFile(const char *path);
+int runScriptStream(int fd);
+void waitForJob(struct processList *rootProcess);
+bool isJobStoppedOrDone(struct processList *rootProcess);
+bool isJobStopped(struct processList *rootProcess);
+int getExitStatus(struct processList *rootProcess);
+pid_t spawnProcess(struct processList *process, char *commandPath, int infd, int outfd);
+void prepareChild(pid_t groupId);
+void execPath(char *commandPath, char **args, char **env);
+bool hasPendingJobs();
+int tailExec(struct processList *process);
+int execCommand(char **args);
+pid_t forkProcess(struct processList *process, char *commandPath, int infd, int outfd);
+unsigned int hashString(const char *str);
+unsigned int hashName(const char *name, size_t length);
+struct variable *findVariable(const char *name, size_t length);
+const char *getVariable(const char *name);
+void setVariable(const char *name, const char *value, bool export);
+void unsetVariable(const char *name);
+void rebuildEnvironment();
+void importEnvironment();
+char **commandEnvironment(char **assignments);
+void clearPathCache();
+void checkPathCache();
+char *findInPath(const char *commandName);
+char *lookupCommandPath(const char *commandName);
+struct pathCacheEntry *findPathCacheEntry(const char *commandName);
+void forgetCommandPath(const char *commandName);
+int hashCommand(char **args);
+
+struct arena lineArena = {NULL, NULL, NULL};
+struct arena astArena = {NULL, NULL, NULL};
+struct astCacheEntry *astCache[AST_CACHE_BUCKETS];
+int astCacheCount = 0;
+int executionDepth = 0;
+int loopDepth = 0;
+int breakLevels = 0;
+int continueLevels = 0;
+bool interrupted = false;
+char *pendingInput = NULL;
+struct variable **variableTable = NULL;
+int variableBuckets = 0;
+int variableCount = 0;
+int exportedCount = 0;
+char **exportedEnv = NULL;
+pid_t shellPid;
+bool ranSubstitution = false;
+int historyFd = -1;
+char *historyMap = NULL;
+size_t historyMapSize = 0;
+size_t *historyIndex = NULL;
+size_t historyCount = 0;
+size_t historyCapacity = 0;
+size_t historyIndexed = 0;
+size_t historyPosition = 0;
+char *historyEditLine = NULL;
+struct directoryListing *directoryCache[DIRECTORY_CACHE_BUCKETS];
+char *direntBuffer = NULL;
+char **commandIndex = NULL;
+int commandIndexCount = 0;
+char *commandIndexNames = NULL;
+char *commandIndexPath = NULL;
+struct timespec *commandIndexTimes = NULL;
+int completionPosition = 0;
+char *historySearchText = NULL;
+size_t historySearchEnd = 0;
+struct job **jobTable = NULL;
+int jobTableSize = 0;
+struct job *currentJob = NULL;
+struct job *doneHead = NULL;
+struct job *doneTail = NULL;
+int doneCount = 0;
+struct pidEntry **pidTable = NULL;
+int pidTableBuckets = 0;
+int pidTableCount = 0;
 struct processList *rootProcess = NULL;
 pid_t cpid;
-int wpid;
-int wstatus;
+int nextStageInput = 0;
+bool tailPosition = false;
 int globalJobNumber = 0;
+int lastExitStatus = 0;
+int sigChildFd = -1;
+bool useSpawn = true;
+bool interactive = true;
+bool traceEnabled = false;
+int traceFd = -1;
+struct traceEvent *traceRing = NULL;
+int traceHead = 0;
+int traceCount = 0;
+bool isMetachar[256];
+#if defined(__SSE2__)
+size_t (*findMetachar)(const char *str, size_t index, size_t length) = findMetacharSse2;
+#else
+size_t (*findMetachar)(const char *str, size_t index, size_t length) = findMetacharScalar;
+#endif
+struct pathCacheEntry **pathCache = NULL;
+int pathCacheBuckets = 0;
+int pathCacheCount = 0;
+char *pathCacheKey = NULL;
+
+struct signalName signalNames[] = {
+    {"HUP", SIGHUP}, {"INT", SIGINT}, {"QUIT", SIGQUIT}, {"ILL", SIGILL}, {"TRAP", SIGTRAP},
+    {"ABRT", SIGABRT}, {"BUS", SIGBUS}, {"FPE", SIGFPE}, {"KILL", SIGKILL}, {"USR1", SIGUSR1},
+    {"SEGV", SIGSEGV}, {"USR2", SIGUSR2}, {"PIPE", SIGPIPE}, {"ALRM", SIGALRM}, {"TERM", SIGTERM},
+    {"CHLD", SIGCHLD}, {"CONT", SIGCONT}, {"STOP", SIGSTOP}, {"TSTP", SIGTSTP}, {"TTIN", SIGTTIN},
+    {"TTOU", SIGTTOU}, {"URG", SIGURG}, {"XCPU", SIGXCPU}, {"XFSZ", SIGXFSZ}, {"VTALRM", SIGVTALRM},
+    {"PROF", SIGPROF}, {"WINCH", SIGWINCH}, {"IO", SIGIO}, {"SYS", SIGSYS}, {NULL, 0}};
+
+struct limitName limitNames[] = {
+    {"as", RLIMIT_AS},         {"core", RLIMIT_CORE},       {"cpu", RLIMIT_CPU},         {"data", RLIMIT_DATA},
+    {"fsize", RLIMIT_FSIZE},   {"memlock", RLIMIT_MEMLOCK}, {"nofile", RLIMIT_NOFILE},   {"nproc", RLIMIT_NPROC},
+    {"rss", RLIMIT_RSS},       {"stack", RLIMIT_STACK},     {NULL, 0}};
+
+extern char **environ;
+
+/** This function returns size bytes from the arena, aligned for any type. Blocks are chained and kept across
+ * resets, so once the arena has grown to fit the largest command line it stops calling malloc altogether**/
+void *arenaAlloc(struct arena *arena, size_t size)
+{
+    struct arenaBlock *block = arena->current;
+
+    size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    while (block != NULL && block->used + size > block->size)
+    {
+        block = block->next;
+    }
+    if (block == NULL)
+    {
+        size_t blockSize = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+
+        block = (struct arenaBlock *)malloc(sizeof(struct arenaBlock) + blockSize);
+        if (block == NULL)
+        {
+            perror("yash: malloc");
+            exit(-1);
+        }
+        block->size = blockSize;
+        block->used = 0;
+        block->next = NULL;
+        if (arena->last == NULL)
+        {
+            arena->first = block;
+        }
+        else
+        {
+            arena->last->next = block;
+        }
+        arena->last = block;
+    }
+    arena->current = block;
+    block->used += size;
+    return block->data + block->used - size;
+}
 
-/** This function checks for empty list**/
-int isEmpty(struct jobList *root)
+/** This function copies the string into the arena**/
+char *arenaStrdup(struct arena *arena, const char *str)
 {
-    return !root;
+    size_t length = strlen(str) + 1;
+
+    return (char *)memcpy(arenaAlloc(arena, length), str, length);
 }
 
-/** This function is to search the job in the joblist and returns true if present**/
-bool search(struct jobList **headRef, int pid)
+/** This function releases everything allocated from the arena at once; the blocks are kept for the next line**/
+void arenaReset(struct arena *arena)
 {
-    struct jobList *temp = *headRef, *prev;
-    while (temp != NULL)
+    struct arenaBlock *block;
+
+    for (block = arena->first; block != NULL; block = block->next)
     {
-        if (temp->jobId == pid)
-            return true;
-        temp = temp->next;
+        block->used = 0;
     }
-    return false;
+    arena->current = arena->first;
 }
 
-/** This function creates a list of pids from the job list**/
-int *getPidList(struct jobList **headRef)
+/** This function remembers how far the arena is filled, see arenaRestore**/
+struct arenaMark arenaSave(struct arena *arena)
 {
-    struct jobList *temp = *headRef;
-    int *pidlist = (int *)malloc(sizeof(int) * 1000);
-    int index = 0;
+    struct arenaMark mark;
+
+    mark.block = arena->current;
+    mark.used = arena->current != NULL ? arena->current->used : 0;
+    return mark;
+}
+
+/** This function releases everything allocated from the arena since the mark was taken**/
+void arenaRestore(struct arena *arena, struct arenaMark mark)
+{
+    struct arenaBlock *block;
 
-    if (headRef == NULL)
+    if (mark.block == NULL)
     {
-        return NULL;
+        arenaReset(arena);
+        return;
     }
-    while (temp != NULL)
+    for (block = mark.block->next; block != NULL; block = block->next)
     {
-        pidlist[index] = temp->jobId;
-        temp = temp->next;
-        index++;
+        block->used = 0;
     }
-    return pidlist;
+    mark.block->used = mark.used;
+    arena->current = mark.block;
 }
 
-/** This function prints the job done message on the terminal**/
-void printdone(struct jobList *root)
+/** This function returns the pid table entry of the given pid or NULL**/
+struct pidEntry *findPid(pid_t pid)
 {
-    if (root != NULL)
+    struct pidEntry *entry;
+
+    if (pidTableBuckets == 0)
     {
-        printf("\n[%d] %s %s %s\n", root->jobCount, root->jobSign, "Done", root->jobCommand);
+        return NULL;
+    }
+    for (entry = pidTable[pid % pidTableBuckets]; entry != NULL; entry = entry->next)
+    {
+        if (entry->pid == pid)
+        {
+            return entry;
+        }
     }
+    return NULL;
 }
 
-/** Handler for SIGCHLD signal sent by the shell to the parent process after termination of child process**/
-void sigChildHandler(int signo)
+/** This function maps the pid of a stage to its job and processList node in the pid table**/
+void registerPid(pid_t pid, struct job *job, struct processList *process)
 {
+    struct pidEntry *entry;
 
-    int *pidlist;
-    pidlist = getPidList(&rootJob);
-    if (pidlist != NULL)
+    if (pidTableCount >= pidTableBuckets)
     {
-        int arraySize = sizeof(pidlist);
-        int intSize = sizeof(pidlist[0]);
-        int length = arraySize / intSize;
-        int pidsize = 0;
-        int index = 0;
-        while (index < length)
-        {
+        // keep the load factor at most one by doubling the bucket array
+        int newBuckets = pidTableBuckets == 0 ? PID_TABLE_MIN_BUCKETS : pidTableBuckets * 2;
+        struct pidEntry **newTable = (struct pidEntry **)calloc(newBuckets, sizeof(struct pidEntry *));
+        struct pidEntry *next;
+        int index;
 
-            int status, pid;
-            if (pidlist[index] != 0)
+        for (index = 0; index < pidTableBuckets; index++)
+        {
+            for (entry = pidTable[index]; entry != NULL; entry = next)
             {
-                pid = waitpid(pidlist[index], &status, WNOHANG);
-                struct jobList *jobObj =
-                    (struct jobList *)
-                        malloc(sizeof(struct jobList));
-                jobObj = deleteJobByPid(&rootJob, pid);
-                printdone(jobObj);
+                next = entry->next;
+                entry->next = newTable[entry->pid % newBuckets];
+                newTable[entry->pid % newBuckets] = entry;
             }
-            index++;
         }
+        free(pidTable);
+        pidTable = newTable;
+        pidTableBuckets = newBuckets;
     }
-}
 
-struct jobList *newNode(int jobId, char *jobCommand, JobStatus jobStatus, int jobCount, struct processList *process)
-{
-    struct jobList *job =
-        (struct jobList *)
-            malloc(sizeof(struct jobList));
-    job->jobCommand = jobCommand;
-    job->jobId = jobId;
-    job->jobStatus = jobStatus;
-    job->jobCount = jobCount;
-    job->process = process;
-    job->jobSign = "+";
-    job->next = NULL;
-    return job;
+    entry = (struct pidEntry *)malloc(sizeof(struct pidEntry));
+    entry->pid = pid;
+    entry->job = job;
+    entry->process = process;
+    entry->next = pidTable[pid % pidTableBuckets];
+    pidTable[pid % pidTableBuckets] = entry;
+    pidTableCount++;
 }
 
-/** This function returns the string value of JobStatus enum **/
-const char *getJobsStatus(JobStatus jobStatus)
+/** This function removes the pid from the pid table**/
+void unregisterPid(pid_t pid)
 {
-    switch (jobStatus)
+    struct pidEntry **link;
+    struct pidEntry *entry;
+
+    if (pidTableBuckets == 0)
     {
-    case RUNNING:
-        return "Running";
-    case STOPPED:
-        return "Stopped";
+        return;
+    }
+    for (link = &pidTable[pid % pidTableBuckets]; (entry = *link) != NULL; link = &entry->next)
+    {
+        if (entry->pid == pid)
+        {
+            *link = entry->next;
+            free(entry);
+            pidTableCount--;
+            return;
+        }
     }
 }
 
-/** This function changes the sign of job from plus to minus**/
-struct jobList *changeJobSign(struct jobList **root)
-{
-    struct jobList *temp = *root;
-    temp->jobSign = "-";
-    return temp;
-}
-
-/** Function to push the new job in the job list **/
-void pushJob(struct jobList **root, int jobId, char *jobCommand, JobStatus jobStatus, int jobCount, struct processList *process)
+/** This function makes the job the current (+) job; the job that was current before becomes the previous (-) one**/
+void touchJob(struct job *job)
 {
-    struct jobList *newJob = newNode(jobId, jobCommand, jobStatus, jobCount, process);
-
-    if (*root == NULL)
+    if (job == currentJob)
     {
-        newJob->next = NULL;
+        return;
     }
-    else
+    if (job->mruPrev != NULL)
+    {
+        job->mruPrev->mruNext = job->mruNext;
+    }
+    if (job->mruNext != NULL)
     {
-        newJob->next = *root;
-        // *root = changeJobSign(root);
+        job->mruNext->mruPrev = job->mruPrev;
     }
-    *root = newJob;
+    job->mruPrev = NULL;
+    job->mruNext = currentJob;
+    if (currentJob != NULL)
+    {
+        currentJob->mruPrev = job;
+    }
+    currentJob = job;
 }
 
-/** Function to pop(remove the job from the top of the list) the job from the job list**/
-struct jobList *popJob(struct jobList **root)
+/** This function copies the state of the pipeline stages out of the line arena so the job can outlive the line.
+ * Only what job control needs is kept; the argument vectors and redirections are dropped**/
+struct processList *copyProcessList(struct processList *rootProcess)
 {
-    if (root == NULL)
+    struct processList *copy = NULL;
+    struct processList **link = &copy;
+    struct processList *proc;
+
+    for (proc = rootProcess; proc != NULL; proc = proc->next)
     {
-        return NULL;
+        struct processList *node = (struct processList *)malloc(sizeof(struct processList));
+
+        *node = *proc;
+        node->processString = NULL;
+        node->inputPath = NULL;
+        node->inputText = NULL;
+        node->assignments = NULL;
+        node->environment = NULL;
+        node->outputPath = NULL;
+        node->processArgs = NULL;
+        node->compound = NULL;
+        node->placement = NULL;
+        node->next = NULL;
+        *link = node;
+        link = &node->next;
     }
-    struct jobList *temp = *root;
-    *root = (*root)->next;
-    return temp;
+    return copy;
 }
 
-/** This function prints all the jobs with their status, command name, count and sign from the job list on the shell terminal**/
-void printJobs(struct jobList *root)
+/** This function frees a process list made by copyProcessList**/
+void freeProcessList(struct processList *rootProcess)
 {
+    struct processList *next;
 
-    if (root != NULL)
+    for (; rootProcess != NULL; rootProcess = next)
     {
-        printJobs(root->next);
-        printf("[%d]%s %s %s\n", root->jobCount, root->jobSign, getJobsStatus(root->jobStatus), root->jobCommand);
+        next = rootProcess->next;
+        if (rootProcess->pidFd >= 0)
+        {
+            close(rootProcess->pidFd);
+        }
+        free(rootProcess);
     }
 }
 
-/** This function deletes the fisrt available job with the given status from the job list **/
-struct jobList *deleteJobByStatus(struct jobList **headRef, JobStatus jobStatus)
+/** This function adds the pipeline to the job table under the next free job number and makes it the current job.
+ * The job gets its own copy of the command and the stages, the parsed line is released when the line is done**/
+struct job *addJob(struct processList *rootProcess, JobStatus jobStatus)
 {
+    struct job *job = (struct job *)malloc(sizeof(struct job));
+    struct processList *proc;
+
+    job->jobId = rootProcess->groupId;
+    job->jobCommand = strdup(rootProcess->processString);
+    job->jobCount = globalJobNumber + 1;
+    job->jobStatus = jobStatus;
+    job->process = copyProcessList(rootProcess);
+    job->mruPrev = NULL;
+    job->mruNext = NULL;
+    job->doneNext = NULL;
+    job->owner = getpid();
 
-    struct jobList *temp = *headRef, *prev;
-    int jobid;
-    if (temp != NULL && temp->jobStatus == jobStatus)
+    if (job->jobCount >= jobTableSize)
     {
-        *headRef = temp->next;
-        return temp;
+        int newSize = jobTableSize == 0 ? JOB_TABLE_MIN_SIZE : jobTableSize * 2;
+        jobTable = (struct job **)realloc(jobTable, sizeof(struct job *) * newSize);
+        memset(jobTable + jobTableSize, 0, sizeof(struct job *) * (newSize - jobTableSize));
+        jobTableSize = newSize;
     }
+    jobTable[job->jobCount] = job;
+    globalJobNumber = job->jobCount;
 
-    while (temp != NULL && temp->jobStatus != jobStatus)
+    for (proc = job->process; proc != NULL; proc = proc->next)
     {
-        prev = temp;
-        temp = temp->next;
+        proc->pidFd = -1;
+        if (proc->cpid > 0)
+        {
+            registerPid(proc->cpid, job, proc);
+            if (!proc->completed)
+            {
+                proc->pidFd = openPidFd(proc->cpid);
+            }
+        }
     }
-
-    if (temp == NULL)
-        return NULL;
-
-    prev->next = temp->next;
-    return temp;
+    touchJob(job);
+    TRACE(TRACE_JOB_ADD, 0, job->jobId, job->jobCount, jobStatus);
+    return job;
 }
 
-/** This function deletes the job with the given pid from the job list **/
-struct jobList *deleteJobByPid(struct jobList **headRef, int pid)
+/** This function removes the job from the job table, the pid table and the current/previous order and frees it**/
+void removeJob(struct job *job)
 {
+    struct processList *proc;
 
-    struct jobList *temp = *headRef, *prev;
-    int jobid;
-    if (temp != NULL && temp->jobId == pid)
+    TRACE(TRACE_JOB_REMOVE, 0, job->jobId, job->jobCount, job->jobStatus);
+
+    for (proc = job->process; proc != NULL; proc = proc->next)
     {
-        *headRef = temp->next;
-        if (temp->jobCount == globalJobNumber)
+        if (proc->cpid > 0)
         {
-            checkPrevJobCount(&temp);
+            unregisterPid(proc->cpid);
         }
-        return temp;
     }
 
-    while (temp != NULL && temp->jobId != pid)
+    jobTable[job->jobCount] = NULL;
+    while (globalJobNumber > 0 && jobTable[globalJobNumber] == NULL)
     {
-        prev = temp;
-        temp = temp->next;
+        globalJobNumber--;
     }
 
-    if (temp == NULL)
-        return NULL;
-
-    prev->next = temp->next;
-    if (temp->jobCount == globalJobNumber)
+    if (job->mruPrev != NULL)
     {
-        checkPrevJobCount(&temp);
+        job->mruPrev->mruNext = job->mruNext;
     }
-    return temp;
-}
-
-/** This function assigns job signs to the jobs before printing them on the terminal**/
-void assigbJobSign(struct jobList **jobRef)
-{
-    struct jobList *curNode = *jobRef;
-    struct jobList *prevNode = NULL;
-
-    if (curNode != NULL)
+    else
     {
-        curNode->jobSign = "+";
+        currentJob = job->mruNext;
     }
-    while (curNode->next != NULL)
+    if (job->mruNext != NULL)
     {
-
-        curNode = curNode->next;
-        curNode->jobSign = "-";
+        job->mruNext->mruPrev = job->mruPrev;
     }
+    freeProcessList(job->process);
+    free(job->jobCommand);
+    free(job);
 }
 
-/**This function updates the globalJobNumber once the job with highest job number gets completed **/
-void checkPrevJobCount(struct jobList **temp)
+/** This function returns the job with the given job number or NULL**/
+struct job *findJobByNumber(int jobCount)
 {
-    struct jobList *prevNode = NULL;
-    struct jobList *curNode = *temp;
-    if (curNode->next != NULL)
+    if (jobCount <= 0 || jobCount > globalJobNumber)
     {
-        prevNode = curNode->next;
-        globalJobNumber = prevNode->jobCount;
-    }else{
-        globalJobNumber = 0;
+        return NULL;
     }
+    return jobTable[jobCount];
 }
 
-/** This function does the initianlization of the shell and handles the signal for yash **/
-void initshell()
-{
-    printf("Welcome to the new YetAnotherShell\n");
-
-    signal(SIGCHLD, sigChildHandler);
-    signal(SIGINT, SIG_IGN);
-    signal(SIGQUIT, SIG_IGN);
-    signal(SIGTSTP, SIG_IGN);
-    signal(SIGTTIN, SIG_IGN);
-
-    pid_t pid = getpid();
-    setpgid(pid, pid);
-    tcsetpgrp(0, pid);
-}
-
-/**To check if the given command is shell command**/
-int checkIfShellCommands(char *inString)
+/** This function returns the sign shown next to the job number: + for the current job, - for the previous one**/
+const char *getJobSign(struct job *job)
 {
-    int isShellCommands = 1;
-    if (strstr(inString, "bg") || strstr(inString, "fg") || strstr(inString, "jobs") || strstr(inString, "exit"))
+    if (job == currentJob)
     {
-        isShellCommands = 0;
-        return isShellCommands;
+        return "+";
     }
-
-    return isShellCommands;
-}
-
-/** Parse the string with the given delimiter**/
-char **parseStringStrtok(char *str, char *delim)
-{
-    char **parsedString = NULL;
-    char *saveptr1;
-    char *token = (char *)malloc(sizeof(char) * 1000);
-    token = strtok_r(str, delim, &saveptr1);
-    int index = 0;
-    while (token != NULL)
+    if (currentJob != NULL && job == currentJob->mruNext)
     {
-        parsedString = realloc(parsedString, sizeof(char *) * ++index);
-        if (parsedString == NULL)
-        {
-            exit(-1);
-        }
-
-        parsedString[index - 1] = token;
-        token = strtok_r(NULL, delim, &saveptr1);
+        return "-";
     }
-    return parsedString;
+    return " ";
 }
 
-/**This function is to parse the command for redirection and set inuput/output file parameters in the process list**/
-struct processList *parseSubCommand(char **subCommand)
+/** This function resolves a job spec: %N, %+ (or %% or %), %-, %string for a job whose command starts with string
+ * and %?string for a job whose command contains it. A NULL spec means the current job. Prints an error for the
+ * builtin and returns NULL if there is no such job**/
+struct job *parseJobSpec(const char *spec, const char *builtinName)
 {
-    int index = 0;
-    char *inputPath = NULL;
-    char *outputPath = NULL;
-    char **mainSubCommand = (char **)malloc(sizeof(char) * 100);
-    int mainIndex = 0;
-    int pos1 = -1;
-    int pos2 = -1;
+    struct job *found = NULL;
+    const char *text;
+    bool contains = false;
+    char *end;
+    int index;
 
-    index = 0;
-    while (subCommand[index] != NULL)
+    if (spec == NULL || strcmp(spec, "%") == 0 || strcmp(spec, "%%") == 0 || strcmp(spec, "%+") == 0)
     {
-        if ((strstr(subCommand[index], "<") || strstr(subCommand[index], ">")) && (pos1 == -1))
+        if (currentJob == NULL)
         {
-            pos1 = index;
-            index++;
-            continue;
+            fprintf(stderr, "yash: %s: no current job\n", builtinName);
         }
-        if ((strstr(subCommand[index], "<") || strstr(subCommand[index], ">")) && (pos1 > 0) && (pos2 == -1))
+        return currentJob;
+    }
+    if (strcmp(spec, "%-") == 0)
+    {
+        if (currentJob == NULL || currentJob->mruNext == NULL)
         {
-            pos2 = index;
-            break;
+            fprintf(stderr, "yash: %s: no previous job\n", builtinName);
+            return NULL;
         }
-        index++;
+        return currentJob->mruNext;
     }
 
-    if (pos2 > 0)
+    text = spec[0] == '%' ? spec + 1 : spec;
+    index = (int)strtol(text, &end, 10);
+    if (*text != '\0' && *end == '\0')
     {
-        if (strstr(subCommand[pos1], "<"))
-        {
-            inputPath = (char *)malloc(100 * sizeof(char));
-            inputPath = subCommand[pos1 + 1];
-            index = 0;
-            while (index < pos1)
-            {
-                mainSubCommand[mainIndex++] = subCommand[index];
-                index++;
-            }
-        }
-        else if (strstr(subCommand[pos2], "<"))
+        if ((found = findJobByNumber(index)) == NULL)
         {
-            inputPath = (char *)malloc(100 * sizeof(char));
-            inputPath = subCommand[pos2 + 1];
+            fprintf(stderr, "yash: %s: %s: no such job\n", builtinName, spec);
         }
+        return found;
+    }
 
-        if (strstr(subCommand[pos1], ">"))
+    if (*text == '?')
+    {
+        contains = true;
+        text++;
+    }
+    for (index = 1; index <= globalJobNumber; index++)
+    {
+        struct job *job = jobTable[index];
+        bool matches;
+
+        if (job == NULL)
         {
-            outputPath = (char *)malloc(100 * sizeof(char));
-            outputPath = subCommand[pos1 + 1];
-            index = 0;
-            while (index < pos1)
-            {
-                mainSubCommand[mainIndex++] = subCommand[index];
-                index++;
-            }
+            continue;
         }
-        else if (strstr(subCommand[pos2], ">"))
+        if (contains)
         {
-            outputPath = (char *)malloc(100 * sizeof(char));
-            outputPath = subCommand[pos1 + 1];
+            matches = strstr(job->jobCommand, text) != NULL;
         }
-    }
-    else if ((pos2 < 0) && (pos1 > 0))
-    {
-        if (strstr(subCommand[pos1], "<"))
+        else
         {
-            inputPath = (char *)malloc(100 * sizeof(char));
-            inputPath = subCommand[pos1 + 1];
-            index = 0;
-            while (index < pos1)
-            {
-                mainSubCommand[mainIndex++] = subCommand[index];
-                index++;
-            }
+            matches = strncmp(job->jobCommand, text, strlen(text)) == 0;
         }
-        else if (strstr(subCommand[pos1], ">"))
+        if (matches)
         {
-            outputPath = (char *)malloc(100 * sizeof(char));
-            outputPath = subCommand[pos1 + 1];
-            index = 0;
-            while (index < pos1)
+            if (found != NULL)
             {
-                mainSubCommand[mainIndex++] = subCommand[index];
-                index++;
+                fprintf(stderr, "yash: %s: %s: ambiguous job spec\n", builtinName, spec);
+                return NULL;
             }
+            found = job;
         }
     }
-    else if ((pos2 < 0) && (pos1 < 0))
+    if (found == NULL)
     {
-        index = 0;
-        while (subCommand[index] != NULL)
-        {
-            mainSubCommand[mainIndex++] = subCommand[index];
-            index++;
-        }
+        fprintf(stderr, "yash: %s: %s: no such job\n", builtinName, spec);
     }
-    mainSubCommand[index] = 0;
-
-    struct processList *process =
-        (struct processList *)
-            malloc(sizeof(struct processList));
+    return found;
+}
 
-    process->inputPath = inputPath;
-    process->outputPath = outputPath;
-    process->processArgs = mainSubCommand;
-    process->next = NULL;
-    return process;
+/** This function prints the job done message on the terminal**/
+void printdone(struct job *root)
+{
+    if (root != NULL)
+    {
+        printf("[%d] %s %s %s\n", root->jobCount, getJobSign(root), "Done", root->jobCommand);
+    }
 }
 
-/**This function checks if the given command has a pipe; if yes then parse the left and right child of the command
- * separatly otherwise pass the entire command at once**/
-struct processList *parseStringforPipes(char **parsedCmdArray)
+/** This function prints the job with its status, command name, count and sign on the shell terminal**/
+void printJob(struct job *job)
 {
+    printf("[%d]%s %s %s\n", job->jobCount, getJobSign(job), getJobsStatus(job->jobStatus), job->jobCommand);
+}
 
-    char **lchild = (char **)malloc(sizeof(char) * 1000);
-    char **rchild = (char **)malloc(sizeof(char) * 1000);
-    // int lchildindex = 0;
-    int index = 0;
-    struct processList *parentProcess = NULL;
-    struct processList *leftChildProcess = NULL;
-    struct processList *rightChildProcess = NULL;
+/** This function records a status change and the resource usage reported by wait4 for the stage with the given pid
+ * and updates the state of the job it belongs to. It runs in the main loop, never in signal context**/
+void updateProcessStatus(pid_t pid, int status, struct rusage *usage)
+{
+    struct pidEntry *entry = findPid(pid);
+    struct job *job;
+    struct processList *proc;
 
-    int cmdArrayLength = 0;
-    while (parsedCmdArray[cmdArrayLength] != NULL)
+    if (entry == NULL)
     {
-        cmdArrayLength++;
+        return;
     }
+    job = entry->job;
+    proc = entry->process;
+    proc->usage = *usage;
 
-    while (parsedCmdArray[index] != NULL)
+    if (WIFSTOPPED(status))
     {
-        if (strstr(parsedCmdArray[index], "|"))
+        TRACE(TRACE_STOP, pid, job->jobId, job->jobCount, WSTOPSIG(status));
+        proc->stopped = true;
+        if (job->jobStatus != STOPPED)
         {
-            int lchildindex = 0;
-            while (lchildindex < index)
-            {
-                lchild[lchildindex] = strdup(parsedCmdArray[lchildindex]);
-                lchildindex++;
-            }
-            lchild[lchildindex] = NULL;
-            int rchildindex = 0;
-            int rindex = index + 1;
-            while (rindex < cmdArrayLength)
-            {
-                rchild[rchildindex] = strdup(parsedCmdArray[rindex]);
-                rchildindex++;
-                rindex++;
-            }
-            rchild[rchildindex] = NULL;
-
-            struct processList *leftChildProcess = parseSubCommand(lchild);
-            struct processList *rightChildProcess = parseSubCommand(rchild);
-
-            parentProcess = leftChildProcess;
-            leftChildProcess->next = rightChildProcess;
-            break;
+            job->jobStatus = STOPPED;
+            touchJob(job);
+            TRACE(TRACE_JOB_STATE, 0, job->jobId, job->jobCount, STOPPED);
         }
-        index++;
     }
-
-    if (parentProcess == NULL)
+    else if (WIFCONTINUED(status))
     {
-        struct processList *process = parseSubCommand(parsedCmdArray);
-        parentProcess = process;
+        TRACE(TRACE_CONTINUE, pid, job->jobId, job->jobCount, 0);
+        proc->stopped = false;
+        if (job->jobStatus != RUNNING)
+        {
+            job->jobStatus = RUNNING;
+            TRACE(TRACE_JOB_STATE, 0, job->jobId, job->jobCount, RUNNING);
+        }
+    }
+    else
+    {
+        TRACE(TRACE_REAP, pid, job->jobId, job->jobCount, status);
+        proc->status = status;
+        proc->completed = true;
+        proc->stopped = false;
+        if (proc->pidFd >= 0)
+        {
+            close(proc->pidFd);
+            proc->pidFd = -1;
+        }
+        if (job->jobStatus != DONE && isJobStoppedOrDone(job->process) && !isJobStopped(job->process))
+        {
+            job->jobStatus = DONE;
+            TRACE(TRACE_JOB_STATE, 0, job->jobId, job->jobCount, DONE);
+            if (doneTail == NULL)
+            {
+                doneHead = job;
+            }
+            else
+            {
+                doneTail->doneNext = job;
+            }
+            doneTail = job;
+            doneCount++;
+        }
+    }
+}
+
+/** This function drains the signalfd and reaps every child that changed state with wait4(-1, WNOHANG) until
+ * there is none left, so a burst of exits delivered as a single SIGCHLD is not lost**/
+void reapChildren()
+{
+    struct signalfd_siginfo info;
+    struct rusage usage;
+    int status;
+    pid_t pid;
+
+    while (read(sigChildFd, &info, sizeof(info)) == sizeof(info))
+    {
+    }
+    while ((pid = wait4(-1, &status, WNOHANG | WUNTRACED | WCONTINUED, &usage)) > 0)
+    {
+        updateProcessStatus(pid, status, &usage);
+    }
+}
+
+/** This function removes every finished background job from the job table, printing its Done message if asked to.
+ * It is called right before the prompt so notifications are batched instead of interrupting the input line**/
+void notifyDoneJobs(bool print)
+{
+    struct job *job;
+
+    while ((job = doneHead) != NULL)
+    {
+        doneHead = job->doneNext;
+        if (print)
+        {
+            printdone(job);
+        }
+        removeJob(job);
+    }
+    doneTail = NULL;
+    doneCount = 0;
+}
+
+/** This function drops finished jobs in a script, where nobody is shown their Done message. The last DONE_JOBS_KEPT
+ * of them are kept so that wait can still collect their status**/
+void trimDoneJobs()
+{
+    struct job *job;
+
+    while (doneCount > DONE_JOBS_KEPT && (job = doneHead) != NULL)
+    {
+        doneHead = job->doneNext;
+        doneCount--;
+        removeJob(job);
+    }
+    if (doneHead == NULL)
+    {
+        doneTail = NULL;
+    }
+}
+
+/** This function removes a job whose status was collected by wait, taking it off the list of finished jobs first if
+ * it is there**/
+void collectJob(struct job *job)
+{
+    struct job **link;
+    struct job *previous = NULL;
+
+    for (link = &doneHead; *link != NULL; previous = *link, link = &(*link)->doneNext)
+    {
+        if (*link == job)
+        {
+            *link = job->doneNext;
+            if (doneTail == job)
+            {
+                doneTail = previous;
+            }
+            doneCount--;
+            break;
+        }
+    }
+    removeJob(job);
+}
+
+/** This function returns a pidfd for the child, which becomes readable when it exits, or -1 if the kernel has none;
+ * the child is then only seen through the signalfd**/
+int openPidFd(pid_t pid)
+{
+#ifdef SYS_pidfd_open
+    return (int)syscall(SYS_pidfd_open, pid, 0);
+#else
+    (void)pid;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+/** This function returns the string value of JobStatus enum **/
+const char *getJobsStatus(JobStatus jobStatus)
+{
+    switch (jobStatus)
+    {
+    case RUNNING:
+        return "Running";
+    case STOPPED:
+        return "Stopped";
+    case DONE:
+        return "Done";
+    }
+    return "";
+}
+
+/** This function does the initianlization of the shell and handles the signal for yash **/
+void initshell()
+{
+    if (interactive)
+    {
+        printf("Welcome to the new YetAnotherShell\n");
+    }
+
+    initMetachars();
+
+    importEnvironment();
+    shellPid = getpid();
+
+    if (getVariable("YASH_TRACE") != NULL)
+    {
+        setTracing(true);
+    }
+
+    const char *launchMode = getVariable("YASH_LAUNCH");
+    if (launchMode != NULL && strcmp(launchMode, "fork") == 0)
+    {
+        useSpawn = false;
+    }
+
+    // SIGCHLD is only ever consumed through the signalfd, children get an empty mask back when they are launched
+    sigset_t childSignal;
+    sigemptyset(&childSignal);
+    sigaddset(&childSignal, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &childSignal, NULL);
+    sigChildFd = signalfd(-1, &childSignal, SFD_NONBLOCK | SFD_CLOEXEC);
+
+    if (!interactive)
+    {
+        // no job control: commands stay in the shell's process group and keep the inherited signal dispositions
+        return;
+    }
+
+    signal(SIGINT, SIG_IGN);
+    signal(SIGQUIT, SIG_IGN);
+    signal(SIGTSTP, SIG_IGN);
+    signal(SIGTTIN, SIG_IGN);
+
+    pid_t pid = getpid();
+    setpgid(pid, pid);
+    tcsetpgrp(0, pid);
+}
+
+/** This function returns the name of the trace event as written to the trace file**/
+const char *getTraceEventName(TraceEventType type)
+{
+    switch (type)
+    {
+    case TRACE_LINE_READ:
+        return "line_read";
+    case TRACE_PARSE_DONE:
+        return "parse_done";
+    case TRACE_PARSE_CACHED:
+        return "parse_cached";
+    case TRACE_SPAWN:
+        return "spawn";
+    case TRACE_FORK:
+        return "fork";
+    case TRACE_TERMINAL:
+        return "terminal";
+    case TRACE_WAIT_BEGIN:
+        return "wait_begin";
+    case TRACE_WAIT_END:
+        return "wait_end";
+    case TRACE_STOP:
+        return "stop";
+    case TRACE_CONTINUE:
+        return "continue";
+    case TRACE_REAP:
+        return "reap";
+    case TRACE_JOB_ADD:
+        return "job_add";
+    case TRACE_JOB_STATE:
+        return "job_state";
+    case TRACE_JOB_REMOVE:
+        return "job_remove";
+    case TRACE_EXEC:
+        return "exec";
+    }
+    return "unknown";
+}
+
+/** This function records an event in the trace ring buffer; it is only called through TRACE, so it costs nothing
+ * but the test of traceEnabled when tracing is off. A full buffer is flushed before it is overwritten**/
+void recordTraceEvent(TraceEventType type, pid_t pid, pid_t pgid, int job, long value)
+{
+    struct traceEvent *event;
+    struct timespec ts;
+
+    if (traceCount == TRACE_RING_SIZE)
+    {
+        flushTrace();
+    }
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    event = &traceRing[(traceHead + traceCount) % TRACE_RING_SIZE];
+    event->time = (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+    event->type = type;
+    event->pid = pid;
+    event->pgid = pgid;
+    event->job = job;
+    event->value = value;
+    traceCount++;
+}
+
+/** This function writes the buffered events to the trace file descriptor as JSON lines and empties the buffer**/
+void flushTrace()
+{
+    char buffer[8192];
+    size_t length = 0;
+    pid_t shell = getpid();
+
+    while (traceCount > 0)
+    {
+        struct traceEvent *event = &traceRing[traceHead];
+
+        length += snprintf(buffer + length, sizeof(buffer) - length,
+                           "{\"t\":%lld,\"event\":\"%s\",\"shell\":%d,\"pid\":%d,\"pgid\":%d,\"job\":%d,\"value\":%ld}\n",
+                           event->time, getTraceEventName(event->type), (int)shell, (int)event->pid,
+                           (int)event->pgid, event->job, event->value);
+        traceHead = (traceHead + 1) % TRACE_RING_SIZE;
+        traceCount--;
+        if (sizeof(buffer) - length < 256 || traceCount == 0)
+        {
+            size_t written = 0;
+
+            while (written < length)
+            {
+                ssize_t count = write(traceFd, buffer + written, length - written);
+                if (count < 0 && errno == EINTR)
+                {
+                    continue;
+                }
+                if (count <= 0)
+                {
+                    // the trace file went away, drop the rest rather than stall the shell
+                    traceCount = 0;
+                    break;
+                }
+                written += count;
+            }
+            length = 0;
+        }
+    }
+    traceHead = 0;
+}
+
+/** atexit handler that writes out what is left in the trace buffer**/
+void flushTraceAtExit()
+{
+    if (traceRing != NULL && traceFd >= 0)
+    {
+        flushTrace();
+    }
+}
+
+/** This function turns tracing on or off. The events go to the descriptor or file named by YASH_TRACE (a number
+ * is taken as a descriptor, anything else as a file to append to) or to stderr. Returns false if the trace file
+ * cannot be opened**/
+bool setTracing(bool enable)
+{
+    if (!enable)
+    {
+        if (traceEnabled)
+        {
+            flushTrace();
+        }
+        traceEnabled = false;
+        return true;
+    }
+    if (traceFd < 0)
+    {
+        const char *target = getVariable("YASH_TRACE");
+        char *end;
+        long fd = target != NULL ? strtol(target, &end, 10) : 2;
+
+        if (target == NULL || (*target != '\0' && *end == '\0'))
+        {
+            traceFd = (int)fd;
+        }
+        else if ((traceFd = open(target, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, S_IRUSR | S_IWUSR)) < 0)
+        {
+            fprintf(stderr, "yash: trace: %s: %s\n", target, strerror(errno));
+            return false;
+        }
+    }
+    if (traceRing == NULL)
+    {
+        traceRing = (struct traceEvent *)malloc(sizeof(struct traceEvent) * TRACE_RING_SIZE);
+        atexit(flushTraceAtExit);
+    }
+    traceEnabled = true;
+    return true;
+}
+
+/** The set builtin: set -o trace / set +o trace turns event tracing on and off, set -o lists the options**/
+int setCommand(char **args)
+{
+    int index;
+
+    if (args[1] == NULL || (strcmp(args[1], "-o") == 0 && args[2] == NULL))
+    {
+        printf("trace\t%s\n", traceEnabled ? "on" : "off");
+        return 0;
+    }
+    for (index = 1; args[index] != NULL; index++)
+    {
+        bool enable = strcmp(args[index], "-o") == 0;
+
+        if (!enable && strcmp(args[index], "+o") != 0)
+        {
+            fprintf(stderr, "yash: set: %s: invalid option\n", args[index]);
+            return 2;
+        }
+        if (args[++index] == NULL)
+        {
+            fprintf(stderr, "yash: set: %s: option name required\n", args[index - 1]);
+            return 2;
+        }
+        if (strcmp(args[index], "trace") != 0)
+        {
+            fprintf(stderr, "yash: set: %s: invalid option name\n", args[index]);
+            return 2;
+        }
+        if (!setTracing(enable))
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/** This function fills the table of characters that end an unquoted run of word characters**/
+void initMetachars()
+{
+    const char *metachars = " \t\n|&;<>()'\"\\$`";
+
+    while (*metachars)
+    {
+        isMetachar[(unsigned char)*metachars++] = true;
+    }
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        findMetachar = findMetacharAvx2;
+    }
+#endif
+}
+
+/** This function returns the index of the first metacharacter at or after index, or length if there is none.
+ * Portable version, one table lookup per byte**/
+size_t findMetacharScalar(const char *str, size_t index, size_t length)
+{
+    while (index < length && !isMetachar[(unsigned char)str[index]])
+    {
+        index++;
+    }
+    return index;
+}
+
+#if defined(__SSE2__)
+/** SSE2 version of findMetacharScalar: compares 16 bytes at a time against every metacharacter**/
+size_t findMetacharSse2(const char *str, size_t index, size_t length)
+{
+    const __m128i space = _mm_set1_epi8(' ');
+    const __m128i tab = _mm_set1_epi8('\t');
+    const __m128i newline = _mm_set1_epi8('\n');
+    const __m128i pipeChar = _mm_set1_epi8('|');
+    const __m128i amp = _mm_set1_epi8('&');
+    const __m128i semi = _mm_set1_epi8(';');
+    const __m128i less = _mm_set1_epi8('<');
+    const __m128i great = _mm_set1_epi8('>');
+    const __m128i lparen = _mm_set1_epi8('(');
+    const __m128i rparen = _mm_set1_epi8(')');
+    const __m128i squote = _mm_set1_epi8('\'');
+    const __m128i dquote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i dollar = _mm_set1_epi8('$');
+    const __m128i backquote = _mm_set1_epi8('`');
+
+    while (index + 16 <= length)
+    {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)(str + index));
+        __m128i hit = _mm_or_si128(
+            _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, space), _mm_cmpeq_epi8(chunk, tab)),
+                         _mm_or_si128(_mm_cmpeq_epi8(chunk, newline), _mm_cmpeq_epi8(chunk, pipeChar))),
+            _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, amp), _mm_cmpeq_epi8(chunk, semi)),
+                         _mm_or_si128(_mm_cmpeq_epi8(chunk, less), _mm_cmpeq_epi8(chunk, great))));
+        hit = _mm_or_si128(hit, _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, lparen), _mm_cmpeq_epi8(chunk, rparen)),
+                                             _mm_or_si128(_mm_cmpeq_epi8(chunk, squote), _mm_cmpeq_epi8(chunk, dquote))));
+        hit = _mm_or_si128(hit, _mm_or_si128(_mm_cmpeq_epi8(chunk, backslash),
+                                             _mm_or_si128(_mm_cmpeq_epi8(chunk, dollar), _mm_cmpeq_epi8(chunk, backquote))));
+
+        int mask = _mm_movemask_epi8(hit);
+        if (mask != 0)
+        {
+            return index + __builtin_ctz(mask);
+        }
+        index += 16;
+    }
+    return findMetacharScalar(str, index, length);
+}
+#endif
+
+#if defined(__x86_64__)
+/** AVX2 version of findMetacharScalar: compares 32 bytes at a time, selected at startup when the CPU has AVX2**/
+__attribute__((target("avx2"))) size_t findMetacharAvx2(const char *str, size_t index, size_t length)
+{
+    const __m256i space = _mm256_set1_epi8(' ');
+    const __m256i tab = _mm256_set1_epi8('\t');
+    const __m256i newline = _mm256_set1_epi8('\n');
+    const __m256i pipeChar = _mm256_set1_epi8('|');
+    const __m256i amp = _mm256_set1_epi8('&');
+    const __m256i semi = _mm256_set1_epi8(';');
+    const __m256i less = _mm256_set1_epi8('<');
+    const __m256i great = _mm256_set1_epi8('>');
+    const __m256i lparen = _mm256_set1_epi8('(');
+    const __m256i rparen = _mm256_set1_epi8(')');
+    const __m256i squote = _mm256_set1_epi8('\'');
+    const __m256i dquote = _mm256_set1_epi8('"');
+    const __m256i backslash = _mm256_set1_epi8('\\');
+    const __m256i dollar = _mm256_set1_epi8('$');
+    const __m256i backquote = _mm256_set1_epi8('`');
+
+    while (index + 32 <= length)
+    {
+        __m256i chunk = _mm256_loadu_si256((const __m256i *)(str + index));
+        __m256i hit = _mm256_or_si256(
+            _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(chunk, space), _mm256_cmpeq_epi8(chunk, tab)),
+                            _mm256_or_si256(_mm256_cmpeq_epi8(chunk, newline), _mm256_cmpeq_epi8(chunk, pipeChar))),
+            _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(chunk, amp), _mm256_cmpeq_epi8(chunk, semi)),
+                            _mm256_or_si256(_mm256_cmpeq_epi8(chunk, less), _mm256_cmpeq_epi8(chunk, great))));
+        hit = _mm256_or_si256(hit, _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(chunk, lparen), _mm256_cmpeq_epi8(chunk, rparen)),
+                                                   _mm256_or_si256(_mm256_cmpeq_epi8(chunk, squote), _mm256_cmpeq_epi8(chunk, dquote))));
+        hit = _mm256_or_si256(hit, _mm256_or_si256(_mm256_cmpeq_epi8(chunk, backslash),
+                                                   _mm256_or_si256(_mm256_cmpeq_epi8(chunk, dollar), _mm256_cmpeq_epi8(chunk, backquote))));
+
+        unsigned int mask = (unsigned int)_mm256_movemask_epi8(hit);
+        if (mask != 0)
+        {
+            return index + __builtin_ctz(mask);
+        }
+        index += 32;
+    }
+    return findMetacharSse2(str, index, length);
+}
+#endif
+
+/** This function returns the text of an operator token for error messages**/
+const char *getTokenText(TokenType type)
+{
+    switch (type)
+    {
+    case TOKEN_PIPE:
+        return "|";
+    case TOKEN_AMP:
+        return "&";
+    case TOKEN_SEMI:
+        return ";";
+    case TOKEN_AND_IF:
+        return "&&";
+    case TOKEN_OR_IF:
+        return "||";
+    case TOKEN_LESS:
+        return "<";
+    case TOKEN_DLESS:
+        return "<<";
+    case TOKEN_DLESSDASH:
+        return "<<-";
+    case TOKEN_TLESS:
+        return "<<<";
+    case TOKEN_GREAT:
+        return ">";
+    case TOKEN_DGREAT:
+        return ">>";
+    case TOKEN_LPAREN:
+        return "(";
+    case TOKEN_RPAREN:
+        return ")";
+    case TOKEN_WORD:
+        return "word";
+    case TOKEN_NEWLINE:
+    case TOKEN_END:
+        break;
+    }
+    return "newline";
+}
+
+/** This function reports a quote (or a $( or ` substitution) that is still open at the end of the text, or only
+ * flags the text as incomplete when more lines may follow. Always returns NULL**/
+struct token *unterminatedQuote(char quote, int *tokenCount, bool final)
+{
+    if (!final)
+    {
+        *tokenCount = INPUT_INCOMPLETE;
+        return NULL;
+    }
+    fprintf(stderr, "yash: unexpected EOF while looking for matching `%c'\n", quote);
+    *tokenCount = 0;
+    return NULL;
+}
+
+/** This function reads the bodies of the here-documents among tokens first to last from the text at *index on,
+ * one after the other, each up to the line holding just its delimiter (tabs in front of the delimiter are allowed
+ * for <<-). The << token is set to the slice of its body and *index is moved behind the last delimiter line.
+ * Returns false when a body is not finished and more text may follow; with final set, a body running to the end
+ * of the text is taken as it is, after a warning**/
+bool readHereDocuments(const char *line, struct token *tokens, int first, int last, size_t *index, bool final)
+{
+    size_t length = strlen(line + *index) + *index;
+    int hereDoc;
+
+    for (hereDoc = first; hereDoc < last - 1; hereDoc++)
+    {
+        struct token delimiterToken = tokens[hereDoc + 1];
+        size_t bodyStart = *index;
+        size_t position = *index;
+        size_t delimiterLength;
+        char *delimiter;
+        bool found = false;
+
+        if ((tokens[hereDoc].type != TOKEN_DLESS && tokens[hereDoc].type != TOKEN_DLESSDASH) ||
+            delimiterToken.type != TOKEN_WORD)
+        {
+            continue;
+        }
+        // the delimiter is compared without its quotes
+        delimiter = (char *)arenaAlloc(&lineArena, delimiterToken.length + 1);
+        memcpy(delimiter, line + delimiterToken.offset, delimiterToken.length);
+        delimiterToken.offset = 0;
+        delimiter = materializeWord(delimiter, &delimiterToken);
+        delimiterLength = strlen(delimiter);
+
+        while (position < length)
+        {
+            const char *newline = (const char *)memchr(line + position, '\n', length - position);
+            size_t lineEnd = newline != NULL ? (size_t)(newline - line) : length;
+            size_t textStart = position;
+
+            if (tokens[hereDoc].type == TOKEN_DLESSDASH)
+            {
+                while (textStart < lineEnd && line[textStart] == '\t')
+                {
+                    textStart++;
+                }
+            }
+            if (lineEnd - textStart == delimiterLength && memcmp(line + textStart, delimiter, delimiterLength) == 0)
+            {
+                found = true;
+                *index = lineEnd < length ? lineEnd + 1 : length;
+                break;
+            }
+            position = lineEnd + 1;
+        }
+        if (!found)
+        {
+            if (!final)
+            {
+                return false;
+            }
+            fprintf(stderr, "yash: warning: here-document delimited by end-of-file (wanted `%s')\n", delimiter);
+            position = length;
+            *index = length;
+        }
+        tokens[hereDoc].offset = bodyStart;
+        tokens[hereDoc].length = position - bodyStart;
+    }
+    return true;
+}
+
+/** This function splits the line into tokens in a single pass. Every token is an (offset, length) slice of the line,
+ * nothing is copied. Unquoted runs of word characters are skipped with findMetachar; quotes and backslashes keep
+ * their text inside the word and mark it for unquoting. Newlines are tokens of their own, a # comment runs to the
+ * end of its line. Here-document bodies are read right after the newline that ends their line and attached to
+ * their << token. The token array comes from the line arena and is ended by a TOKEN_END token. Returns NULL on an
+ * unterminated quote or here-document, with *tokenCount set to INPUT_INCOMPLETE instead of an error message unless
+ * final is set**/
+struct token *tokenizeLine(const char *line, int *tokenCount, bool final)
+{
+    size_t length = strlen(line);
+    struct token *tokens = (struct token *)arenaAlloc(&lineArena, sizeof(struct token) * (length + 1));
+    size_t index = 0;
+    int count = 0;
+    int hereDocStart = 0;
+
+    while (1)
+    {
+        struct token *token;
+
+        while (index < length && (line[index] == ' ' || line[index] == '\t'))
+        {
+            index++;
+        }
+        if (index < length && line[index] == '#')
+        {
+            const char *newline = memchr(line + index, '\n', length - index);
+            index = newline != NULL ? (size_t)(newline - line) : length;
+        }
+        if (index >= length)
+        {
+            break;
+        }
+
+        token = &tokens[count++];
+        token->offset = index;
+        token->quoted = false;
+        token->expand = false;
+        switch (line[index])
+        {
+        case '|':
+            token->type = line[index + 1] == '|' ? TOKEN_OR_IF : TOKEN_PIPE;
+            break;
+        case '&':
+            token->type = line[index + 1] == '&' ? TOKEN_AND_IF : TOKEN_AMP;
+            break;
+        case ';':
+            token->type = TOKEN_SEMI;
+            break;
+        case '<':
+            if (line[index + 1] != '<')
+            {
+                token->type = TOKEN_LESS;
+            }
+            else
+            {
+                token->type = line[index + 2] == '<' ? TOKEN_TLESS : line[index + 2] == '-' ? TOKEN_DLESSDASH : TOKEN_DLESS;
+            }
+            break;
+        case '>':
+            token->type = line[index + 1] == '>' ? TOKEN_DGREAT : TOKEN_GREAT;
+            break;
+        case '(':
+            token->type = TOKEN_LPAREN;
+            break;
+        case ')':
+            token->type = TOKEN_RPAREN;
+            break;
+        case '\n':
+            token->type = TOKEN_NEWLINE;
+            break;
+        default:
+            token->type = TOKEN_WORD;
+            break;
+        }
+
+        if (token->type != TOKEN_WORD)
+        {
+            token->length = token->type == TOKEN_NEWLINE ? 1 : strlen(getTokenText(token->type));
+            index += token->length;
+            if (token->type == TOKEN_NEWLINE)
+            {
+                // the bodies of the here-documents started on this line follow it
+                if (!readHereDocuments(line, tokens, hereDocStart, count, &index, final))
+                {
+                    *tokenCount = INPUT_INCOMPLETE;
+                    return NULL;
+                }
+                hereDocStart = count;
+            }
+            continue;
+        }
+
+        while (index < length)
+        {
+            index = findMetachar(line, index, length);
+            if (index >= length)
+            {
+                break;
+            }
+            if (line[index] == '\'')
+            {
+                const char *close = memchr(line + index + 1, '\'', length - index - 1);
+                if (close == NULL)
+                {
+                    return unterminatedQuote('\'', tokenCount, final);
+                }
+                token->quoted = true;
+                index = close - line + 1;
+            }
+            else if (line[index] == '"')
+            {
+                index++;
+                while (index < length && line[index] != '"')
+                {
+                    if (line[index] == '$' || line[index] == '`')
+                    {
+                        size_t start = index;
+
+                        if ((index = skipExpansion(line, index, length, &token->expand)) == (size_t)-1)
+                        {
+                            return unterminatedQuote(getClosingChar(line, start), tokenCount, final);
+                        }
+                        continue;
+                    }
+                    index += (line[index] == '\\' && index + 1 < length) ? 2 : 1;
+                }
+                if (index >= length)
+                {
+                    return unterminatedQuote('"', tokenCount, final);
+                }
+                token->quoted = true;
+                index++;
+            }
+            else if (line[index] == '\\')
+            {
+                token->quoted = true;
+                index += index + 1 < length ? 2 : 1;
+            }
+            else if (line[index] == '$' || line[index] == '`')
+            {
+                size_t start = index;
+
+                if ((index = skipExpansion(line, index, length, &token->expand)) == (size_t)-1)
+                {
+                    return unterminatedQuote(getClosingChar(line, start), tokenCount, final);
+                }
+            }
+            else
+            {
+                // a blank or an operator ends the word
+                break;
+            }
+        }
+        token->length = index - token->offset;
+        if (!token->expand && hasGlobChar(line + token->offset, token->length))
+        {
+            // a pattern is matched against the file system when the command runs
+            token->expand = true;
+        }
+    }
+    if (!readHereDocuments(line, tokens, hereDocStart, count, &index, final))
+    {
+        *tokenCount = INPUT_INCOMPLETE;
+        return NULL;
+    }
+
+    tokens[count].type = TOKEN_END;
+    tokens[count].offset = length;
+    tokens[count].length = 0;
+    tokens[count].quoted = false;
+    tokens[count].expand = false;
+    *tokenCount = count;
+    return tokens;
+}
+
+/** This function terminates the slice of a word token in place and leaves its quotes, for words that are expanded
+ * when the command runs. Like materializeWord, it must only be called once the whole line is tokenized**/
+char *rawWord(char *line, struct token *token)
+{
+    line[token->offset + token->length] = '\0';
+    return line + token->offset;
+}
+
+/** This function turns a word token into a C string in place: quotes and backslashes are removed (the result is never
+ * longer than the slice) and the string is terminated where the slice ends. The tokens of the line must all have been
+ * produced before, since the terminator may overwrite the first character of the following operator**/
+char *materializeWord(char *line, struct token *token)
+{
+    char *word = line + token->offset;
+    char *end = word + token->length;
+    char *read = word;
+    char *write = word;
+
+    if (!token->quoted)
+    {
+        *end = '\0';
+        return word;
+    }
+
+    while (read < end)
+    {
+        if (*read == '\'')
+        {
+            read++;
+            while (*read != '\'')
+            {
+                *write++ = *read++;
+            }
+            read++;
+        }
+        else if (*read == '"')
+        {
+            read++;
+            while (*read != '"')
+            {
+                if (*read == '\\' && (read[1] == '\\' || read[1] == '"' || read[1] == '$' || read[1] == '`'))
+                {
+                    read++;
+                }
+                else if (*read == '\\' && read[1] == '\n')
+                {
+                    read += 2;
+                    continue;
+                }
+                *write++ = *read++;
+            }
+            read++;
+        }
+        else if (*read == '\\')
+        {
+            read++;
+            if (read < end && *read == '\n')
+            {
+                read++;
+            }
+            else if (read < end)
+            {
+                *write++ = *read++;
+            }
+        }
+        else
+        {
+            *write++ = *read++;
+        }
+    }
+    *write = '\0';
+    return word;
+}
+
+/** This function prints a syntax error for the token; words are quoted with their text**/
+void syntaxError(const char *source, struct token *token)
+{
+    if (token->type == TOKEN_WORD)
+    {
+        fprintf(stderr, "yash: syntax error near unexpected token `%.*s'\n", token->length, source + token->offset);
+    }
+    else
+    {
+        fprintf(stderr, "yash: syntax error near unexpected token `%s'\n", getTokenText(token->type));
+    }
+}
+
+/** This function checks if the token is a redirection operator, which takes the following word**/
+bool isRedirection(TokenType type)
+{
+    return type == TOKEN_LESS || type == TOKEN_DLESS || type == TOKEN_DLESSDASH || type == TOKEN_TLESS ||
+           type == TOKEN_GREAT || type == TOKEN_DGREAT;
+}
+
+/** This function copies the body of the here-document token into the arena of the tree, without the tabs in front
+ * of each line for <<-**/
+char *copyHereDocument(struct parser *parser, struct token *token)
+{
+    const char *body = parser->source + token->offset;
+    char *text = (char *)arenaAlloc(parser->arena, token->length + 1);
+    int read = 0;
+    int write = 0;
+
+    if (token->type == TOKEN_DLESS)
+    {
+        memcpy(text, body, token->length);
+        text[token->length] = '\0';
+        return text;
+    }
+    while (read < token->length)
+    {
+        while (read < token->length && body[read] == '\t')
+        {
+            read++;
+        }
+        while (read < token->length && body[read] != '\n')
+        {
+            text[write++] = body[read++];
+        }
+        if (read < token->length)
+        {
+            text[write++] = body[read++];
+        }
+    }
+    text[write] = '\0';
+    return text;
+}
+
+/** This function checks if the current token is the given reserved word. Reserved words are only recognized
+ * unquoted and where a command could start, which is the only place the parser asks for them**/
+bool isWord(struct parser *parser, const char *word)
+{
+    struct token *token = &parser->tokens[parser->pos];
+    size_t length = strlen(word);
+
+    return token->type == TOKEN_WORD && !token->quoted && (size_t)token->length == length &&
+           strncmp(parser->source + token->offset, word, length) == 0;
+}
+
+/** This function checks if the current token is a reserved word that ends a list inside a compound command**/
+bool isListTerminator(struct parser *parser)
+{
+    return isWord(parser, "then") || isWord(parser, "elif") || isWord(parser, "else") || isWord(parser, "fi") ||
+           isWord(parser, "do") || isWord(parser, "done");
+}
+
+/** This function marks the parse as failed at the current token. Running out of tokens is not an error yet: the
+ * command is only incomplete and may go on on the next line**/
+struct astNode *parseFailure(struct parser *parser)
+{
+    if (parser->tokens[parser->pos].type == TOKEN_END)
+    {
+        parser->incomplete = true;
+    }
+    else
+    {
+        syntaxError(parser->source, &parser->tokens[parser->pos]);
+    }
+    parser->failed = true;
+    return NULL;
+}
+
+/** This function consumes the expected reserved word or fails the parse**/
+bool expectWord(struct parser *parser, const char *word)
+{
+    if (isWord(parser, word))
+    {
+        parser->pos++;
+        return true;
+    }
+    parseFailure(parser);
+    return false;
+}
+
+/** This function skips the newlines that may appear between commands**/
+void skipNewlines(struct parser *parser)
+{
+    while (parser->tokens[parser->pos].type == TOKEN_NEWLINE)
+    {
+        parser->pos++;
+    }
+}
+
+/** This function allocates a node of the syntax tree**/
+struct astNode *newNode(struct parser *parser, NodeType type)
+{
+    struct astNode *node = (struct astNode *)arenaAlloc(parser->arena, sizeof(struct astNode));
+
+    memset(node, 0, sizeof(struct astNode));
+    node->type = type;
+    return node;
+}
+
+/** This function copies the source text of the tokens [start, end) for the job list**/
+char *copySourceText(struct parser *parser, int start, int end)
+{
+    int offset = parser->tokens[start].offset;
+    int length = parser->tokens[end - 1].offset + parser->tokens[end - 1].length - offset;
+    char *text = (char *)arenaAlloc(parser->arena, length + 1);
+
+    memcpy(text, parser->source + offset, length);
+    text[length] = '\0';
+    return text;
+}
+
+/** list: and-or lists separated by ;, & or newlines, up to the end of the input or a reserved word that closes the
+ * enclosing compound command. Returns NULL for an empty list (or a failed parse, see parser->failed)**/
+struct astNode *parseList(struct parser *parser)
+{
+    struct astNode *list = NULL;
+    struct astNode **link = &list;
+
+    skipNewlines(parser);
+    while (parser->tokens[parser->pos].type != TOKEN_END && !isListTerminator(parser))
+    {
+        int start = parser->pos;
+        struct astNode *node = parseAndOr(parser);
+        struct astNode *item;
+        TokenType type;
+
+        if (node == NULL)
+        {
+            return NULL;
+        }
+        type = parser->tokens[parser->pos].type;
+        if (type == TOKEN_AMP)
+        {
+            struct astNode *background = newNode(parser, NODE_BACKGROUND);
+
+            background->left = node;
+            background->text = copySourceText(parser, start, parser->pos + 1);
+            if (node->type == NODE_PIPELINE)
+            {
+                // the job list shows the & with the command
+                node->text = background->text;
+            }
+            node = background;
+            parser->pos++;
+        }
+        else if (type == TOKEN_SEMI || type == TOKEN_NEWLINE)
+        {
+            parser->pos++;
+        }
+        else if (type != TOKEN_END && !isListTerminator(parser))
+        {
+            return parseFailure(parser);
+        }
+
+        item = newNode(parser, NODE_SEQUENCE);
+        item->left = node;
+        *link = item;
+        link = &item->right;
+        skipNewlines(parser);
+    }
+    return list;
+}
+
+/** This function parses a list that must not be empty, like the condition or the body of a compound command**/
+struct astNode *parseRequiredList(struct parser *parser)
+{
+    struct astNode *list = parseList(parser);
+
+    if (list == NULL && !parser->failed)
+    {
+        return parseFailure(parser);
+    }
+    return list;
+}
+
+/** and-or list: pipelines joined by && and ||, which bind left to right with equal precedence**/
+struct astNode *parseAndOr(struct parser *parser)
+{
+    struct astNode *node = parsePipelineNode(parser);
+
+    while (node != NULL &&
+           (parser->tokens[parser->pos].type == TOKEN_AND_IF || parser->tokens[parser->pos].type == TOKEN_OR_IF))
+    {
+        struct astNode *parent = newNode(parser, parser->tokens[parser->pos].type == TOKEN_AND_IF ? NODE_AND : NODE_OR);
+
+        parser->pos++;
+        skipNewlines(parser);
+        parent->left = node;
+        if ((parent->right = parsePipelineNode(parser)) == NULL)
+        {
+            return NULL;
+        }
+        node = parent;
+    }
+    return node;
+}
+
+/** pipeline: [time] command { | command }. The text of the pipeline is kept for the job list**/
+struct astNode *parsePipelineNode(struct parser *parser)
+{
+    struct astNode *node = newNode(parser, NODE_PIPELINE);
+    struct stage **link = &node->stages;
+    int start;
+
+    if (isWord(parser, "time"))
+    {
+        TokenType next;
+
+        node->timed = true;
+        parser->pos++;
+        next = parser->tokens[parser->pos].type;
+        if (next == TOKEN_END || next == TOKEN_SEMI || next == TOKEN_NEWLINE || next == TOKEN_AMP)
+        {
+            // time on its own reports an empty pipeline
+            return node;
+        }
+    }
+
+    start = parser->pos;
+    while (1)
+    {
+        struct stage *stage = parseStage(parser);
+
+        if (stage == NULL)
+        {
+            return NULL;
+        }
+        *link = stage;
+        link = &stage->next;
+        if (parser->tokens[parser->pos].type != TOKEN_PIPE)
+        {
+            break;
+        }
+        parser->pos++;
+        skipNewlines(parser);
+    }
+    node->text = copySourceText(parser, start, parser->pos);
+    return node;
+}
+
+/** command: a compound command (if, while, until, for) or the words of a simple command, either followed by
+ * redirections: <, > and >> take the following word as the file**/
+struct stage *parseStage(struct parser *parser)
+{
+    struct stage *stage = (struct stage *)arenaAlloc(parser->arena, sizeof(struct stage));
+    char **args;
+    char **assignments = NULL;
+    int argc = 0;
+    int assignmentCount = 0;
+    int index;
+
+    memset(stage, 0, sizeof(struct stage));
+    if (isWord(parser, "if"))
+    {
+        stage->compound = parseIf(parser);
+    }
+    else if (isWord(parser, "while") || isWord(parser, "until"))
+    {
+        stage->compound = parseLoop(parser);
+    }
+    else if (isWord(parser, "for"))
+    {
+        stage->compound = parseFor(parser);
+    }
+    else if (isListTerminator(parser))
+    {
+        return (struct stage *)parseFailure(parser);
+    }
+    if (parser->failed)
+    {
+        return NULL;
+    }
+
+    for (index = parser->pos; parser->tokens[index].type == TOKEN_WORD || isRedirection(parser->tokens[index].type);
+         index++)
+    {
+        // one word with a substitution makes the stage keep all its words for expansion at run time
+        stage->expand |= parser->tokens[index].expand;
+    }
+    args = (char **)arenaAlloc(parser->arena, sizeof(char *) * (index - parser->pos + 1));
+
+    while (1)
+    {
+        struct token *token = &parser->tokens[parser->pos];
+
+        if (token->type == TOKEN_WORD)
+        {
+            if (stage->compound != NULL)
+            {
+                return (struct stage *)parseFailure(parser);
+            }
+            if (argc == 0 && isAssignment(parser->source, token))
+            {
+                if (assignments == NULL)
+                {
+                    assignments = (char **)arenaAlloc(parser->arena, sizeof(char *) * (index - parser->pos + 1));
+                }
+                assignments[assignmentCount++] = stageWord(parser, stage);
+            }
+            else
+            {
+                args[argc++] = stageWord(parser, stage);
+            }
+        }
+        else if (isRedirection(token->type))
+        {
+            if (parser->tokens[parser->pos + 1].type != TOKEN_WORD)
+            {
+                syntaxError(parser->source, &parser->tokens[parser->pos + 1]);
+                parser->failed = true;
+                return NULL;
+            }
+            parser->pos++;
+            if (token->type == TOKEN_LESS)
+            {
+                stage->inputPath = stageWord(parser, stage);
+                stage->inputText = NULL;
+                stage->hereString = NULL;
+            }
+            else if (token->type == TOKEN_DLESS || token->type == TOKEN_DLESSDASH)
+            {
+                stage->inputText = copyHereDocument(parser, token);
+                // with an unquoted delimiter the body is expanded when the stage runs
+                stage->expandInput = !parser->tokens[parser->pos].quoted && strpbrk(stage->inputText, "$`\\") != NULL;
+                stage->inputPath = NULL;
+                stage->hereString = NULL;
+            }
+            else if (token->type == TOKEN_TLESS)
+            {
+                stage->hereString = stageWord(parser, stage);
+                stage->inputText = NULL;
+                stage->inputPath = NULL;
+            }
+            else
+            {
+                stage->outputPath = stageWord(parser, stage);
+                stage->appendOutput = token->type == TOKEN_DGREAT;
+            }
+        }
+        else
+        {
+            break;
+        }
+        parser->pos++;
+    }
+    args[argc] = NULL;
+
+    if (stage->compound == NULL)
+    {
+        if (argc == 0 && assignmentCount == 0)
+        {
+            return (struct stage *)parseFailure(parser);
+        }
+        stage->args = args;
+        if (assignments != NULL)
+        {
+            assignments[assignmentCount] = NULL;
+            stage->assignments = assignments;
+        }
+    }
+    return stage;
+}
+
+/** This function checks if the word token is a NAME=value assignment**/
+bool isAssignment(const char *source, struct token *token)
+{
+    const char *word = source + token->offset;
+    const char *equals = (const char *)memchr(word, '=', token->length);
+
+    return equals != NULL && equals > word && isValidName(word, equals - word);
+}
+
+/** This function returns the current word of the stage, without its quotes or, if the stage has substitutions,
+ * as it is written for expansion when the stage runs**/
+char *stageWord(struct parser *parser, struct stage *stage)
+{
+    struct token *token = &parser->tokens[parser->pos];
+
+    return stage->expand ? rawWord(parser->line, token) : materializeWord(parser->line, token);
+}
+
+/** if list then list { elif list then list } [ else list ] fi. An elif is parsed as a nested if in the else branch
+ * that consumes the closing fi**/
+struct astNode *parseIf(struct parser *parser)
+{
+    struct astNode *node = newNode(parser, NODE_IF);
+
+    parser->pos++;
+    if ((node->left = parseRequiredList(parser)) == NULL || !expectWord(parser, "then") ||
+        (node->right = parseRequiredList(parser)) == NULL)
+    {
+        return NULL;
+    }
+    if (isWord(parser, "elif"))
+    {
+        node->elseBranch = parseIf(parser);
+        return node->elseBranch != NULL ? node : NULL;
+    }
+    if (isWord(parser, "else"))
+    {
+        parser->pos++;
+        if ((node->elseBranch = parseRequiredList(parser)) == NULL)
+        {
+            return NULL;
+        }
+    }
+    return expectWord(parser, "fi") ? node : NULL;
+}
+
+/** while list do list done and until list do list done**/
+struct astNode *parseLoop(struct parser *parser)
+{
+    struct astNode *node = newNode(parser, isWord(parser, "while") ? NODE_WHILE : NODE_UNTIL);
+
+    parser->pos++;
+    if ((node->left = parseRequiredList(parser)) == NULL || !expectWord(parser, "do") ||
+        (node->right = parseRequiredList(parser)) == NULL || !expectWord(parser, "done"))
+    {
+        return NULL;
+    }
+    return node;
+}
+
+/** for name [ in word ... ] ; do list done**/
+struct astNode *parseFor(struct parser *parser)
+{
+    struct astNode *node = newNode(parser, NODE_FOR);
+    struct token *token;
+    int index;
+
+    parser->pos++;
+    token = &parser->tokens[parser->pos];
+    if (token->type != TOKEN_WORD || token->quoted || !isValidName(parser->source + token->offset, token->length))
+    {
+        return parseFailure(parser);
+    }
+    node->name = materializeWord(parser->line, token);
+    parser->pos++;
+
+    if (isWord(parser, "in"))
+    {
+        parser->pos++;
+        for (index = parser->pos; parser->tokens[index].type == TOKEN_WORD; index++)
+        {
+            node->expand |= parser->tokens[index].expand;
+        }
+        node->words = (char **)arenaAlloc(parser->arena, sizeof(char *) * (index - parser->pos + 1));
+        for (; parser->pos < index; parser->pos++)
+        {
+            token = &parser->tokens[parser->pos];
+            node->words[node->wordCount++] = node->expand ? rawWord(parser->line, token) : materializeWord(parser->line, token);
+        }
+        node->words[node->wordCount] = NULL;
+        if (parser->tokens[parser->pos].type != TOKEN_SEMI && parser->tokens[parser->pos].type != TOKEN_NEWLINE)
+        {
+            return parseFailure(parser);
+        }
+    }
+    if (parser->tokens[parser->pos].type == TOKEN_SEMI)
+    {
+        parser->pos++;
+    }
+    skipNewlines(parser);
+    if (!expectWord(parser, "do") || (node->right = parseRequiredList(parser)) == NULL || !expectWord(parser, "done"))
+    {
+        return NULL;
+    }
+    return node;
+}
+
+/** This function empties the syntax tree cache; the trees live in their own arena, which keeps its blocks**/
+void clearAstCache()
+{
+    memset(astCache, 0, sizeof(astCache));
+    astCacheCount = 0;
+    arenaReset(&astArena);
+}
+
+/** This function returns the syntax tree of the source text. Trees are cached by text, so a line that is run again
+ * (from history, or a script line in a loop) is tokenized and parsed once. result is set to 0, to 2 after a syntax
+ * error or to INPUT_INCOMPLETE when the text ends inside a compound command, a quote or after an operator and
+ * final is not set. An empty line gives NULL with a result of 0**/
+struct astNode *parseSource(const char *source, bool final, int *result)
+{
+    unsigned int hash = hashString(source);
+    struct astCacheEntry *entry;
+    struct arenaMark mark;
+    struct parser parser;
+    int tokenCount;
+    struct astNode *ast;
+
+    for (entry = astCache[hash % AST_CACHE_BUCKETS]; entry != NULL; entry = entry->next)
+    {
+        if (entry->hash == hash && strcmp(entry->source, source) == 0)
+        {
+            TRACE(TRACE_PARSE_CACHED, 0, 0, 0, 0);
+            *result = 0;
+            return entry->ast;
+        }
+    }
+
+    if (astCacheCount >= AST_CACHE_MAX_ENTRIES && executionDepth == 0)
+    {
+        // the trees of running commands must stay where they are, so the cache is only emptied between commands
+        clearAstCache();
+    }
+    mark = arenaSave(&astArena);
+    parser.source = arenaStrdup(&astArena, source);
+    parser.line = arenaStrdup(&astArena, source);
+    parser.arena = &astArena;
+    parser.pos = 0;
+    parser.failed = false;
+    parser.incomplete = false;
+
+    if ((parser.tokens = tokenizeLine(parser.line, &tokenCount, final)) == NULL)
+    {
+        arenaRestore(&astArena, mark);
+        *result = tokenCount < 0 ? INPUT_INCOMPLETE : 2;
+        return NULL;
+    }
+    ast = parseList(&parser);
+    if (!parser.failed && parser.tokens[parser.pos].type != TOKEN_END)
+    {
+        // a reserved word such as done or fi with nothing to close
+        parseFailure(&parser);
+    }
+    if (parser.failed)
+    {
+        arenaRestore(&astArena, mark);
+        if (parser.incomplete && !final)
+        {
+            *result = INPUT_INCOMPLETE;
+            return NULL;
+        }
+        if (parser.incomplete)
+        {
+            fprintf(stderr, "yash: syntax error: unexpected end of file\n");
+        }
+        *result = 2;
+        return NULL;
+    }
+    TRACE(TRACE_PARSE_DONE, 0, 0, 0, tokenCount);
+
+    entry = (struct astCacheEntry *)arenaAlloc(&astArena, sizeof(struct astCacheEntry));
+    entry->source = (char *)parser.source;
+    entry->hash = hash;
+    entry->ast = ast;
+    entry->next = astCache[hash % AST_CACHE_BUCKETS];
+    astCache[hash % AST_CACHE_BUCKETS] = entry;
+    astCacheCount++;
+    *result = 0;
+    return ast;
+}
+
+/** FNV-1a hash of a string, used by the command path cache**/
+unsigned int hashString(const char *str)
+{
+    unsigned int hash = 2166136261u;
+
+    while (*str)
+    {
+        hash ^= (unsigned char)*str++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/** FNV-1a hash of the first length bytes of a variable name**/
+unsigned int hashName(const char *name, size_t length)
+{
+    unsigned int hash = 2166136261u;
+    size_t index;
+
+    for (index = 0; index < length; index++)
+    {
+        hash ^= (unsigned char)name[index];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/** This function returns the variable with the name given by its first length bytes, or NULL**/
+struct variable *findVariable(const char *name, size_t length)
+{
+    unsigned int hash;
+    struct variable *var;
+
+    if (variableBuckets == 0)
+    {
+        return NULL;
+    }
+    hash = hashName(name, length);
+    for (var = variableTable[hash % variableBuckets]; var != NULL; var = var->next)
+    {
+        if (var->hash == hash && var->nameLength == length && memcmp(var->entry, name, length) == 0)
+        {
+            return var;
+        }
+    }
+    return NULL;
+}
+
+/** This function returns the value of the shell variable, or NULL if it is not set**/
+const char *getVariable(const char *name)
+{
+    struct variable *var = findVariable(name, strlen(name));
+
+    return var != NULL ? var->entry + var->nameLength + 1 : NULL;
+}
+
+/** This function sets the shell variable, creating it if needed, and exports it if export is set (an exported
+ * variable stays exported). Changing the value of an exported variable only replaces its slot in the cached
+ * environment; the environment is rebuilt when a variable becomes exported**/
+void setVariable(const char *name, const char *value, bool export)
+{
+    size_t nameLength = strlen(name);
+    size_t valueLength = strlen(value);
+    struct variable *var = findVariable(name, nameLength);
+
+    if (var == NULL)
+    {
+        if (variableCount >= variableBuckets)
+        {
+            // keep the load factor at most one by doubling the bucket array
+            int newBuckets = variableBuckets == 0 ? VARIABLE_TABLE_MIN_BUCKETS : variableBuckets * 2;
+            struct variable **newTable = (struct variable **)calloc(newBuckets, sizeof(struct variable *));
+            struct variable *next;
+            int index;
+
+            for (index = 0; index < variableBuckets; index++)
+            {
+                for (var = variableTable[index]; var != NULL; var = next)
+                {
+                    next = var->next;
+                    var->next = newTable[var->hash % newBuckets];
+                    newTable[var->hash % newBuckets] = var;
+                }
+            }
+            free(variableTable);
+            variableTable = newTable;
+            variableBuckets = newBuckets;
+        }
+        var = (struct variable *)malloc(sizeof(struct variable));
+        var->entry = NULL;
+        var->nameLength = nameLength;
+        var->hash = hashName(name, nameLength);
+        var->exported = false;
+        var->envIndex = -1;
+        var->next = variableTable[var->hash % variableBuckets];
+        variableTable[var->hash % variableBuckets] = var;
+        variableCount++;
+    }
+
+    var->entry = (char *)realloc(var->entry, nameLength + valueLength + 2);
+    memcpy(var->entry, name, nameLength);
+    var->entry[nameLength] = '=';
+    memcpy(var->entry + nameLength + 1, value, valueLength + 1);
+
+    if (export && !var->exported)
+    {
+        var->exported = true;
+        exportedCount++;
+        rebuildEnvironment();
+    }
+    else if (var->exported && var->envIndex >= 0)
+    {
+        exportedEnv[var->envIndex] = var->entry;
+    }
+}
+
+/** This function removes the shell variable; the environment is rebuilt if it was exported**/
+void unsetVariable(const char *name)
+{
+    size_t nameLength = strlen(name);
+    struct variable **link;
+    struct variable *var;
+
+    if (variableBuckets == 0)
+    {
+        return;
+    }
+    for (link = &variableTable[hashName(name, nameLength) % variableBuckets]; (var = *link) != NULL; link = &var->next)
+    {
+        if (var->nameLength == nameLength && memcmp(var->entry, name, nameLength) == 0)
+        {
+            *link = var->next;
+            variableCount--;
+            if (var->exported)
+            {
+                exportedCount--;
+                var->exported = false;
+                // the old array still points at the entry until it is rebuilt
+                rebuildEnvironment();
+            }
+            free(var->entry);
+            free(var);
+            return;
+        }
+    }
+}
+
+/** This function rebuilds the cached envp array from the exported variables and makes it the environ of the shell.
+ * Commands are started with this array as it is, so nothing is serialized per command**/
+void rebuildEnvironment()
+{
+    struct variable *var;
+    int index;
+    int count = 0;
+
+    exportedEnv = (char **)realloc(exportedEnv, sizeof(char *) * (exportedCount + 1));
+    for (index = 0; index < variableBuckets; index++)
+    {
+        for (var = variableTable[index]; var != NULL; var = var->next)
+        {
+            if (var->exported)
+            {
+                var->envIndex = count;
+                exportedEnv[count++] = var->entry;
+            }
+        }
+    }
+    exportedEnv[count] = NULL;
+    environ = exportedEnv;
+}
+
+/** This function turns the environment the shell was started with into exported shell variables**/
+void importEnvironment()
+{
+    char **env;
+
+    for (env = environ; *env != NULL; env++)
+    {
+        char *equals = strchr(*env, '=');
+        struct variable *var;
+
+        if (equals == NULL || !isValidName(*env, equals - *env))
+        {
+            continue;
+        }
+        *equals = '\0';
+        setVariable(*env, equals + 1, false);
+        var = findVariable(*env, equals - *env);
+        *equals = '=';
+        if (!var->exported)
+        {
+            var->exported = true;
+            exportedCount++;
+        }
+    }
+    rebuildEnvironment();
+}
+
+/** This function returns the environment for a command run with NAME=value assignments in front of it: the cached
+ * environment with the assigned variables replaced or added, built in the line arena**/
+char **commandEnvironment(char **assignments)
+{
+    int assignmentCount = 0;
+    int count = 0;
+    char **env;
+    char **result;
+
+    while (assignments[assignmentCount] != NULL)
+    {
+        assignmentCount++;
+    }
+    result = (char **)arenaAlloc(&lineArena, sizeof(char *) * (exportedCount + assignmentCount + 1));
+    for (env = exportedEnv; *env != NULL; env++)
+    {
+        size_t nameLength = strchr(*env, '=') - *env + 1;
+        int index;
+
+        for (index = 0; index < assignmentCount; index++)
+        {
+            if (strncmp(assignments[index], *env, nameLength) == 0)
+            {
+                break;
+            }
+        }
+        if (index == assignmentCount)
+        {
+            result[count++] = *env;
+        }
+    }
+    memcpy(result + count, assignments, sizeof(char *) * assignmentCount);
+    result[count + assignmentCount] = NULL;
+    return result;
+}
+
+/** This function empties the command path cache**/
+void clearPathCache()
+{
+    int index;
+    struct pathCacheEntry *entry;
+    struct pathCacheEntry *next;
+
+    for (index = 0; index < pathCacheBuckets; index++)
+    {
+        for (entry = pathCache[index]; entry != NULL; entry = next)
+        {
+            next = entry->next;
+            free(entry->commandName);
+            free(entry->commandPath);
+            free(entry);
+        }
+        pathCache[index] = NULL;
+    }
+    pathCacheCount = 0;
+}
+
+/** This function drops every cached path when PATH differs from the value the cache was filled with**/
+void checkPathCache()
+{
+    const char *path = getVariable("PATH");
+
+    if (path == NULL)
+    {
+        path = DEFAULT_PATH;
+    }
+    if (pathCacheKey != NULL && strcmp(pathCacheKey, path) == 0)
+    {
+        return;
+    }
+    clearPathCache();
+    free(pathCacheKey);
+    pathCacheKey = strdup(path);
+}
+
+/** This function walks PATH the way execvp does and returns the first executable regular file found
+ * for the command, or NULL. The returned string is allocated**/
+char *findInPath(const char *commandName)
+{
+    const char *path = getVariable("PATH");
+    size_t nameLength = strlen(commandName);
+    struct stat sb;
+
+    if (path == NULL)
+    {
+        path = DEFAULT_PATH;
+    }
+    while (1)
+    {
+        const char *end = strchrnul(path, ':');
+        size_t dirLength = end - path;
+        char *candidate = (char *)malloc(dirLength + nameLength + 3);
+
+        if (dirLength == 0)
+        {
+            // an empty PATH entry means the current directory
+            strcpy(candidate, "./");
+        }
+        else
+        {
+            memcpy(candidate, path, dirLength);
+            candidate[dirLength] = '/';
+            candidate[dirLength + 1] = '\0';
+        }
+        strcat(candidate, commandName);
+
+        if (stat(candidate, &sb) == 0 && S_ISREG(sb.st_mode) && access(candidate, X_OK) == 0)
+        {
+            return candidate;
+        }
+        free(candidate);
+
+        if (*end == '\0')
+        {
+            break;
+        }
+        path = end + 1;
+    }
+    return NULL;
+}
+
+/** This function returns the cache entry of the command or NULL**/
+struct pathCacheEntry *findPathCacheEntry(const char *commandName)
+{
+    struct pathCacheEntry *entry;
+
+    if (pathCacheBuckets == 0)
+    {
+        return NULL;
+    }
+    for (entry = pathCache[hashString(commandName) % pathCacheBuckets]; entry != NULL; entry = entry->next)
+    {
+        if (strcmp(entry->commandName, commandName) == 0)
+        {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+/** This function returns the absolute path of the command from the cache, resolving and caching it on a miss.
+ * Names containing a slash are returned as they are. Returns NULL if the command is not found**/
+char *lookupCommandPath(const char *commandName)
+{
+    struct pathCacheEntry *entry;
+    unsigned int hash = hashString(commandName);
+    char *commandPath;
+
+    if (strchr(commandName, '/') != NULL)
+    {
+        return (char *)commandName;
+    }
+
+    checkPathCache();
+    if (pathCacheBuckets == 0)
+    {
+        pathCacheBuckets = PATH_CACHE_MIN_BUCKETS;
+        pathCache = (struct pathCacheEntry **)calloc(pathCacheBuckets, sizeof(struct pathCacheEntry *));
+    }
+
+    if ((entry = findPathCacheEntry(commandName)) != NULL)
+    {
+        entry->hits++;
+        return entry->commandPath;
+    }
+
+    if ((commandPath = findInPath(commandName)) == NULL)
+    {
+        return NULL;
+    }
+
+    if (pathCacheCount >= pathCacheBuckets * 2)
+    {
+        // keep the chains short by doubling the bucket array
+        int newBuckets = pathCacheBuckets * 2;
+        struct pathCacheEntry **newCache = (struct pathCacheEntry **)calloc(newBuckets, sizeof(struct pathCacheEntry *));
+        int index;
+        struct pathCacheEntry *next;
+
+        for (index = 0; index < pathCacheBuckets; index++)
+        {
+            for (entry = pathCache[index]; entry != NULL; entry = next)
+            {
+                next = entry->next;
+                entry->next = newCache[hashString(entry->commandName) % newBuckets];
+                newCache[hashString(entry->commandName) % newBuckets] = entry;
+            }
+        }
+        free(pathCache);
+        pathCache = newCache;
+        pathCacheBuckets = newBuckets;
+    }
+
+    entry = (struct pathCacheEntry *)malloc(sizeof(struct pathCacheEntry));
+    entry->commandName = strdup(commandName);
+    entry->commandPath = commandPath;
+    entry->hits = 1;
+    entry->next = pathCache[hash % pathCacheBuckets];
+    pathCache[hash % pathCacheBuckets] = entry;
+    pathCacheCount++;
+    return commandPath;
+}
+
+/** This function removes a stale entry from the command path cache, e.g. after its exec failed with ENOENT**/
+void forgetCommandPath(const char *commandName)
+{
+    struct pathCacheEntry **link;
+    struct pathCacheEntry *entry;
+
+    if (pathCacheBuckets == 0)
+    {
+        return;
+    }
+    for (link = &pathCache[hashString(commandName) % pathCacheBuckets]; (entry = *link) != NULL; link = &entry->next)
+    {
+        if (strcmp(entry->commandName, commandName) == 0)
+        {
+            *link = entry->next;
+            free(entry->commandName);
+            free(entry->commandPath);
+            free(entry);
+            pathCacheCount--;
+            return;
+        }
+    }
+}
+
+/** The hash builtin: with no arguments it lists the cached commands, -r clears the cache, -d name forgets
+ * the given commands and any other names are resolved and added to the cache**/
+int hashCommand(char **args)
+{
+    int index = 1;
+    int status = 0;
+
+    if (args[1] == NULL)
+    {
+        int bucket;
+        struct pathCacheEntry *entry;
+
+        checkPathCache();
+        if (pathCacheCount == 0)
+        {
+            printf("hash: hash table empty\n");
+            return 0;
+        }
+        printf("hits\tcommand\n");
+        for (bucket = 0; bucket < pathCacheBuckets; bucket++)
+        {
+            for (entry = pathCache[bucket]; entry != NULL; entry = entry->next)
+            {
+                printf("%4d\t%s\n", entry->hits, entry->commandPath);
+            }
+        }
+        return 0;
+    }
+
+    if (strcmp(args[1], "-r") == 0)
+    {
+        clearPathCache();
+        return 0;
+    }
+    if (strcmp(args[1], "-d") == 0)
+    {
+        for (index = 2; args[index] != NULL; index++)
+        {
+            forgetCommandPath(args[index]);
+        }
+        return 0;
+    }
+
+    for (; args[index] != NULL; index++)
+    {
+        if (strchr(args[index], '/') != NULL)
+        {
+            continue;
+        }
+        if (lookupCommandPath(args[index]) == NULL)
+        {
+            fprintf(stderr, "yash: hash: %s: not found\n", args[index]);
+            status = 1;
+        }
+        else
+        {
+            // pre-warming is not a use of the command
+            findPathCacheEntry(args[index])->hits--;
+        }
+    }
+    return status;
+}
+
+/**This function launches the process with posix_spawn. glibc implements it with clone(CLONE_VM|CLONE_VFORK),
+ * so unlike fork the cost does not grow with the size of the shell's heap and page tables. The child is put in
+ * the process group, gets its stdin/stdout redirected and has the job control signals reset to default exactly
+ * like the fork path does. Returns the pid of the child or -1 with errno set**/
+pid_t spawnProcess(struct processList *process, char *commandPath, int infd, int outfd)
+{
+    posix_spawnattr_t attr;
+    posix_spawn_file_actions_t actions;
+    sigset_t defaultSignals;
+    sigset_t emptyMask;
+    pid_t pid = -1;
+    int err;
+
+    if ((err = posix_spawnattr_init(&attr)) != 0)
+    {
+        errno = err;
+        return -1;
+    }
+    if ((err = posix_spawn_file_actions_init(&actions)) != 0)
+    {
+        posix_spawnattr_destroy(&attr);
+        errno = err;
+        return -1;
+    }
+
+    sigemptyset(&defaultSignals);
+    sigaddset(&defaultSignals, SIGINT);
+    sigaddset(&defaultSignals, SIGQUIT);
+    sigaddset(&defaultSignals, SIGTSTP);
+    sigaddset(&defaultSignals, SIGTTIN);
+    sigaddset(&defaultSignals, SIGTTOU);
+    sigaddset(&defaultSignals, SIGCHLD);
+    sigemptyset(&emptyMask);
+
+    posix_spawnattr_setflags(&attr, (interactive || process->ownGroup ? POSIX_SPAWN_SETPGROUP : 0) | POSIX_SPAWN_SETSIGDEF |
+                                        POSIX_SPAWN_SETSIGMASK);
+    posix_spawnattr_setpgroup(&attr, process->groupId > 0 ? process->groupId : 0);
+    posix_spawnattr_setsigdefault(&attr, &defaultSignals);
+    posix_spawnattr_setsigmask(&attr, &emptyMask);
+
+    if (infd != 0)
+    {
+        posix_spawn_file_actions_adddup2(&actions, infd, STDIN_FILENO);
+        posix_spawn_file_actions_addclose(&actions, infd);
+    }
+    if (outfd != 1)
+    {
+        posix_spawn_file_actions_adddup2(&actions, outfd, STDOUT_FILENO);
+        posix_spawn_file_actions_addclose(&actions, outfd);
+    }
+
+    err = posix_spawn(&pid, commandPath, &actions, &attr, process->processArgs,
+                      process->environment != NULL ? process->environment : exportedEnv);
+
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+    if (err != 0)
+    {
+        errno = err;
+        return -1;
+    }
+    return pid;
+}
+
+/**This function sets up a forked child the way posix_spawn sets up a spawned one: empty signal mask, default job
+ * control signals and, with job control, the process group of the job (a new one if groupId is 0)**/
+void prepareChild(pid_t groupId)
+{
+    sigset_t emptyMask;
+    sigemptyset(&emptyMask);
+    sigprocmask(SIG_SETMASK, &emptyMask, NULL);
+
+    signal(SIGINT, SIG_DFL);
+    signal(SIGQUIT, SIG_DFL);
+    signal(SIGTSTP, SIG_DFL);
+    signal(SIGTTIN, SIG_DFL);
+    signal(SIGTTOU, SIG_DFL);
+    signal(SIGCHLD, SIG_DFL);
+
+    // the parent still owns whatever it had buffered
+    traceHead = 0;
+    traceCount = 0;
+
+    if (interactive)
+    {
+        setpgid(0, groupId > 0 ? groupId : 0);
+    }
+}
+
+/**This function launches the process with fork and execve. It is the fallback for spawnProcess and is used
+ * when YASH_LAUNCH=fork is set or posix_spawn cannot handle the command. Without a command path the child runs
+ * the builtin named by the first argument instead**/
+pid_t forkProcess(struct processList *process, char *commandPath, int infd, int outfd)
+{
+    pid_t pid = fork();
+
+    if (pid == 0)
+    {
+        // child process
+        prepareChild(process->groupId);
+        if (process->ownGroup && !interactive)
+        {
+            setpgid(0, 0);
+        }
+        if (process->placement != NULL && !applyPlacement(0, process->placement))
+        {
+            _exit(126);
+        }
+
+        if (infd != 0)
+        {
+            dup2(infd, STDIN_FILENO);
+            close(infd);
+        }
+        if (outfd != 1)
+        {
+            dup2(outfd, STDOUT_FILENO);
+            close(outfd);
+        }
+
+        if (nextStageInput != 0)
+        {
+            // a forked shell does not exec, so O_CLOEXEC does not drop the read end meant for the next stage
+            close(nextStageInput);
+        }
+        if (process->compound != NULL)
+        {
+            // a compound command in a pipeline or in the background runs in a copy of the shell without job control
+            int status;
+
+            interactive = false;
+            tailPosition = true;
+            status = executeNode(process->compound);
+            fflush(stdout);
+            if (traceEnabled)
+            {
+                flushTrace();
+            }
+            _exit(status);
+        }
+        if (commandPath == NULL)
+        {
+            int status = findBuiltin(process->processArgs[0])->handler(process->processArgs);
+            fflush(stdout);
+            if (traceEnabled)
+            {
+                flushTrace();
+            }
+            _exit(status);
+        }
+
+        execPath(commandPath, process->processArgs, process->environment != NULL ? process->environment : exportedEnv);
+        fprintf(stderr, "yash: %s: %s\n", process->processArgs[0], strerror(errno));
+        _exit(127);
+    }
+    return pid;
+}
+
+/** This function executes the command file like execvp does: a file without a #! line is handed to the system
+ * shell. Only returns if neither could be executed, with errno set**/
+void execPath(char *commandPath, char **args, char **env)
+{
+    execve(commandPath, args, env);
+    if (errno == ENOEXEC)
+    {
+        int argc = 0;
+        char **shellArgs;
+
+        while (args[argc] != NULL)
+        {
+            argc++;
+        }
+        shellArgs = (char **)malloc(sizeof(char *) * (argc + 2));
+        shellArgs[0] = "/bin/sh";
+        shellArgs[1] = commandPath;
+        memcpy(shellArgs + 2, args + 1, sizeof(char *) * argc);
+        execve(shellArgs[0], shellArgs, env);
+        free(shellArgs);
+        errno = ENOEXEC;
+    }
+}
+
+/** This function checks if the shell has jobs that are still running or stopped; a forked copy of the shell does
+ * not count the jobs it inherited from its parent**/
+bool hasPendingJobs()
+{
+    pid_t self = getpid();
+    int number;
+
+    reapChildren();
+    for (number = 1; number <= globalJobNumber; number++)
+    {
+        struct job *job = jobTable[number];
+
+        if (job != NULL && job->owner == self && job->jobStatus != DONE)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/** This function runs the last command of a non-interactive shell by executing it in the shell process instead of
+ * forking and waiting for it: the redirections are applied to the shell itself and the command takes over its pid
+ * and exit status. Only returns if the command cannot be run, with its status**/
+int tailExec(struct processList *process)
+{
+    char *commandPath = lookupCommandPath(process->processArgs[0]);
+    int fd;
+
+    if (commandPath == NULL)
+    {
+        fprintf(stderr, "yash: %s: command not found\n", process->processArgs[0]);
+        return 127;
+    }
+    if (process->inputPath != NULL || process->inputText != NULL)
+    {
+        if ((fd = openInputRedirection(process)) < 0)
+        {
+            return 1;
+        }
+        dup2(fd, STDIN_FILENO);
+        close(fd);
+    }
+    if (process->outputPath != NULL)
+    {
+        fd = open(process->outputPath, O_CREAT | O_WRONLY | (process->appendOutput ? O_APPEND : O_TRUNC) | O_CLOEXEC,
+                  S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+        if (fd < 0)
+        {
+            fprintf(stderr, "yash: %s: %s\n", process->outputPath, strerror(errno));
+            return 1;
+        }
+        dup2(fd, STDOUT_FILENO);
+        close(fd);
+    }
+
+    fflush(stdout);
+    TRACE(TRACE_EXEC, getpid(), 0, 0, 0);
+    if (traceEnabled)
+    {
+        flushTrace();
+    }
+    prepareChild(0);
+    execPath(commandPath, process->processArgs, process->environment != NULL ? process->environment : exportedEnv);
+    fprintf(stderr, "yash: %s: %s\n", process->processArgs[0], strerror(errno));
+    return errno == ENOENT ? 127 : 126;
+}
+
+/** The exec builtin: exec command [arg ...] replaces the shell with the command. Without a command it does nothing
+ * itself, runBuiltin leaves its redirections in place for the shell. A non-interactive shell exits if the command
+ * cannot be executed**/
+int execCommand(char **args)
+{
+    char **env = exportedEnv;
+    char *commandPath;
+    int status;
+
+    if (args[1] == NULL)
+    {
+        return 0;
+    }
+    if (rootProcess != NULL && rootProcess->processArgs == args && rootProcess->environment != NULL)
+    {
+        // the assignments in front of exec go to the command
+        env = rootProcess->environment;
+    }
+    if ((commandPath = lookupCommandPath(args[1])) == NULL)
+    {
+        fprintf(stderr, "yash: exec: %s: not found\n", args[1]);
+        status = 127;
+    }
+    else
+    {
+        sigset_t childSignal;
+
+        fflush(stdout);
+        TRACE(TRACE_EXEC, getpid(), 0, 0, 0);
+        if (traceEnabled)
+        {
+            flushTrace();
+        }
+        prepareChild(getpgrp());
+        execPath(commandPath, args + 1, env);
+        fprintf(stderr, "yash: exec: %s: %s\n", args[1], strerror(errno));
+        status = errno == ENOENT ? 127 : 126;
+
+        // the shell goes on, with its own signal setup
+        sigemptyset(&childSignal);
+        sigaddset(&childSignal, SIGCHLD);
+        sigprocmask(SIG_BLOCK, &childSignal, NULL);
+        if (interactive)
+        {
+            signal(SIGINT, SIG_IGN);
+            signal(SIGQUIT, SIG_IGN);
+            signal(SIGTSTP, SIG_IGN);
+            signal(SIGTTIN, SIG_IGN);
+        }
+    }
+    if (!interactive)
+    {
+        fflush(stdout);
+        exit(status);
+    }
+    return status;
+}
+
+/**This function starts one stage of the pipeline by spawning the process (or fork and execve as a fallback)
+ * with the given stdin/stdout and puts it in the process group stored in the stage, or in a new group if there
+ * is none yet. Returns the pid of the child or -1**/
+int exexuteCommands(struct processList *rootProcess, int infd, int outfd)
+{
+
+    char *commandName = rootProcess->compound != NULL ? NULL : rootProcess->processArgs[0];
+    char *commandPath;
+    TraceEventType launch = TRACE_SPAWN;
+
+    if (commandName == NULL || findBuiltin(commandName) != NULL)
+    {
+        // a builtin or compound command in a pipeline or in the background runs in a forked copy of the shell
+        launch = TRACE_FORK;
+        cpid = forkProcess(rootProcess, NULL, infd, outfd);
+    }
+    else
+    {
+        if ((commandPath = lookupCommandPath(commandName)) == NULL)
+        {
+            fprintf(stderr, "yash: %s: command not found\n", commandName);
+            return -1;
+        }
+
+        cpid = -1;
+        if (useSpawn && rootProcess->placement == NULL)
+        {
+            cpid = spawnProcess(rootProcess, commandPath, infd, outfd);
+            if (cpid < 0 && errno == ENOENT && commandPath != commandName)
+            {
+                // the cached binary went away, resolve it again once
+                forgetCommandPath(commandName);
+                if ((commandPath = lookupCommandPath(commandName)) == NULL)
+                {
+                    fprintf(stderr, "yash: %s: command not found\n", commandName);
+                    return -1;
+                }
+                cpid = spawnProcess(rootProcess, commandPath, infd, outfd);
+            }
+            if (cpid < 0 && (errno == ENOENT || errno == EACCES || errno == ENOTDIR))
+            {
+                fprintf(stderr, "yash: %s: %s\n", commandName, strerror(errno));
+                return -1;
+            }
+        }
+        if (cpid < 0)
+        {
+            // posix_spawn does not run scripts without a #! line (ENOEXEC) and may fail for resource reasons,
+            // so fall back to fork and execve
+            if (!useSpawn && commandPath != commandName && access(commandPath, X_OK) != 0)
+            {
+                forgetCommandPath(commandName);
+                if ((commandPath = lookupCommandPath(commandName)) == NULL)
+                {
+                    fprintf(stderr, "yash: %s: command not found\n", commandName);
+                    return -1;
+                }
+            }
+            launch = TRACE_FORK;
+            cpid = forkProcess(rootProcess, commandPath, infd, outfd);
+        }
+    }
+
+    if (cpid < 0)
+    {
+
+        return -1;
+    }
+
+    // parent process; set the group here as well so it is in place before the shell hands over the terminal
+    rootProcess->cpid = cpid;
+    if (rootProcess->groupId <= 0)
+    {
+        rootProcess->groupId = cpid;
+    }
+    if (interactive || rootProcess->ownGroup)
+    {
+        setpgid(cpid, rootProcess->groupId);
+    }
+    TRACE(launch, cpid, rootProcess->groupId, 0, 0);
+    return cpid;
+}
+
+/**This function checks if every stage of the job has either exited or stopped**/
+bool isJobStoppedOrDone(struct processList *rootProcess)
+{
+    struct processList *proc;
+
+    for (proc = rootProcess; proc != NULL; proc = proc->next)
+    {
+        if (!proc->completed && !proc->stopped)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**This function checks if any stage of the job is stopped**/
+bool isJobStopped(struct processList *rootProcess)
+{
+    struct processList *proc;
+
+    for (proc = rootProcess; proc != NULL; proc = proc->next)
+    {
+        if (proc->stopped)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**This function returns the exit status of the job, which is the status of its last stage**/
+int getExitStatus(struct processList *rootProcess)
+{
+    struct processList *proc = rootProcess;
+
+    while (proc->next != NULL)
+    {
+        proc = proc->next;
+    }
+    if (WIFSIGNALED(proc->status))
+    {
+        return 128 + WTERMSIG(proc->status);
+    }
+    return WEXITSTATUS(proc->status);
+}
+
+/**This function waits until every stage of the job has either exited or stopped. The stages are reaped by
+ * process group, so the order in which they finish does not matter. Without job control the stages share the
+ * shell's process group and are waited for one by one instead**/
+void waitForJob(struct processList *rootProcess)
+{
+    struct processList *proc;
+    struct rusage usage;
+    int status;
+    pid_t pid;
+
+    TRACE(TRACE_WAIT_BEGIN, 0, rootProcess->groupId, 0, 0);
+    if (!interactive)
+    {
+        for (proc = rootProcess; proc != NULL; proc = proc->next)
+        {
+            while (!proc->completed && proc->cpid > 0)
+            {
+                if (wait4(proc->cpid, &status, 0, &usage) == proc->cpid)
+                {
+                    proc->status = status;
+                    proc->usage = usage;
+                    proc->completed = true;
+                    TRACE(TRACE_REAP, proc->cpid, rootProcess->groupId, 0, status);
+                }
+                else if (errno != EINTR)
+                {
+                    proc->completed = true;
+                }
+            }
+        }
+        TRACE(TRACE_WAIT_END, 0, rootProcess->groupId, 0, 0);
+        return;
+    }
+
+    while (!isJobStoppedOrDone(rootProcess))
+    {
+        pid = wait4(-rootProcess->groupId, &status, WUNTRACED, &usage);
+        if (pid < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            // nothing left to wait for in the group
+            for (proc = rootProcess; proc != NULL; proc = proc->next)
+            {
+                if (!proc->stopped)
+                {
+                    proc->completed = true;
+                }
+            }
+            break;
+        }
+        for (proc = rootProcess; proc != NULL; proc = proc->next)
+        {
+            if (proc->cpid == pid)
+            {
+                proc->status = status;
+                proc->usage = usage;
+                if (WIFSTOPPED(status))
+                {
+                    proc->stopped = true;
+                    TRACE(TRACE_STOP, pid, rootProcess->groupId, 0, WSTOPSIG(status));
+                }
+                else
+                {
+                    proc->completed = true;
+                    TRACE(TRACE_REAP, pid, rootProcess->groupId, 0, status);
+                }
+                break;
+            }
+        }
+    }
+    TRACE(TRACE_WAIT_END, 0, rootProcess->groupId, 0, 0);
+}
+
+/** This function puts the here-document text into a descriptor to read it from. Text that fits the pipe buffer is
+ * written to a pipe ahead of the reader, anything larger goes to a memfd, so no temporary file is ever created.
+ * Returns the read descriptor or -1 after printing an error**/
+int openHereDocument(const char *text)
+{
+    size_t length = strlen(text);
+    size_t written = 0;
+    int pipefd[2];
+    int fd;
+
+    if (length <= PIPE_BUF && pipe2(pipefd, O_CLOEXEC) == 0)
+    {
+        if (write(pipefd[1], text, length) == (ssize_t)length)
+        {
+            close(pipefd[1]);
+            return pipefd[0];
+        }
+        close(pipefd[0]);
+        close(pipefd[1]);
+    }
+
+    if ((fd = memfd_create("yash-heredoc", MFD_CLOEXEC)) < 0)
+    {
+        perror("yash: here-document");
+        return -1;
+    }
+    while (written < length)
+    {
+        ssize_t count = write(fd, text + written, length - written);
+        if (count < 0)
+        {
+            perror("yash: here-document");
+            close(fd);
+            return -1;
+        }
+        written += count;
+    }
+    lseek(fd, 0, SEEK_SET);
+    return fd;
+}
+
+/** This function opens what the stage reads as stdin, its here-document or its input file. Returns the descriptor
+ * or -1 after printing an error**/
+int openInputRedirection(struct processList *process)
+{
+    int fd;
+
+    if (process->inputText != NULL)
+    {
+        return openHereDocument(process->inputText);
+    }
+    if ((fd = open(process->inputPath, O_RDONLY | O_CLOEXEC)) < 0)
+    {
+        fprintf(stderr, "yash: %s: %s\n", process->inputPath, strerror(errno));
+    }
+    return fd;
+}
+
+/**This function connects the stages of the pipeline with one O_CLOEXEC pipe per link, opens the redirection
+ * files and starts every stage in the process group of the first one. The parent closes each pipe end as soon
+ * as the stage using it has been started, so no stage holds a stray write end that would delay EOF. A foreground
+ * job is then waited for stage by stage, a background job is added to the job list**/
+int executeParsedCommand(struct processList *rootProcess, int job_type)
+{
+    struct processList *proc;
+    int pipefd[2];
+    int prevRead = 0;
+    int groupId = 0;
+
+    for (proc = rootProcess; proc != NULL; proc = proc->next)
+    {
+        int infd = prevRead;
+        int outfd = 1;
+        bool failed = false;
+
+        prevRead = 0;
+        if (proc->next != NULL)
+        {
+            if (pipe2(pipefd, O_CLOEXEC) < 0)
+            {
+                perror("yash: pipe");
+                if (infd != 0)
+                {
+                    close(infd);
+                }
+                for (; proc != NULL; proc = proc->next)
+                {
+                    proc->completed = true;
+                    proc->status = 1 << 8;
+                }
+                break;
+            }
+            outfd = pipefd[1];
+            prevRead = pipefd[0];
+        }
+
+        if (proc->inputPath != NULL || proc->inputText != NULL)
+        {
+            if (infd != 0)
+            {
+                close(infd);
+            }
+            if ((infd = openInputRedirection(proc)) < 0)
+            {
+                infd = 0;
+                failed = true;
+            }
+        }
+        if (proc->outputPath != NULL && !failed)
+        {
+            if (outfd != 1)
+            {
+                close(outfd);
+            }
+            outfd = open(proc->outputPath, O_CREAT | O_WRONLY | (proc->appendOutput ? O_APPEND : O_TRUNC) | O_CLOEXEC,
+                         S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+            if (outfd < 0)
+            {
+                fprintf(stderr, "yash: %s: %s\n", proc->outputPath, strerror(errno));
+                outfd = 1;
+                failed = true;
+            }
+        }
+
+        proc->groupId = groupId;
+        nextStageInput = prevRead;
+        if (failed)
+        {
+            proc->completed = true;
+            proc->status = 1 << 8;
+        }
+        else if (exexuteCommands(proc, infd, outfd) < 0)
+        {
+            proc->completed = true;
+            proc->status = 127 << 8;
+        }
+        else if (groupId == 0)
+        {
+            groupId = proc->groupId;
+        }
+
+        if (infd != 0)
+        {
+            close(infd);
+        }
+        if (outfd != 1)
+        {
+            close(outfd);
+        }
+    }
+
+    for (proc = rootProcess; proc != NULL; proc = proc->next)
+    {
+        proc->groupId = groupId;
+    }
+    if (groupId == 0)
+    {
+        // no stage could be started
+        lastExitStatus = getExitStatus(rootProcess);
+        return lastExitStatus;
+    }
+
+    if (job_type == fg)
+    {
+        if (interactive)
+        {
+            tcsetpgrp(0, groupId);
+            TRACE(TRACE_TERMINAL, 0, groupId, 0, 0);
+        }
+        waitForJob(rootProcess);
+
+        if (interactive)
+        {
+            signal(SIGTTOU, SIG_IGN);
+            tcsetpgrp(0, getpid());
+            signal(SIGTTOU, SIG_DFL);
+            TRACE(TRACE_TERMINAL, 0, getpid(), 0, 0);
+        }
+
+        if (isJobStopped(rootProcess))
+        {
+            printf("\n");
+            printJob(addJob(rootProcess, STOPPED));
+            lastExitStatus = 128 + SIGTSTP;
+        }
+        else
+        {
+            lastExitStatus = getExitStatus(rootProcess);
+        }
+    }
+    else
+    {
+        addJob(rootProcess, RUNNING);
+        lastExitStatus = 0;
+    }
+    return lastExitStatus;
+}
+
+/** The fg builtin: continues the job in the foreground, hands it the terminal and waits for it**/
+int foregroundJob(char **args)
+{
+    struct job *job;
+    struct processList *proc;
+    pid_t pid;
+    int status;
+
+    if (!interactive)
+    {
+        fprintf(stderr, "yash: fg: no job control\n");
+        return 1;
+    }
+    if ((job = parseJobSpec(args[1], "fg")) == NULL)
+    {
+        return 1;
+    }
+    if (job->jobStatus == DONE)
+    {
+        fprintf(stderr, "yash: fg: job has terminated\n");
+        return 1;
+    }
+
+    pid = job->process->groupId;
+    printf("%s\n", job->jobCommand);
+    fflush(stdout);
+    for (proc = job->process; proc != NULL; proc = proc->next)
+    {
+        proc->stopped = false;
+    }
+    tcsetpgrp(0, pid);
+    TRACE(TRACE_TERMINAL, 0, pid, job->jobCount, 0);
+    if (job->jobStatus == STOPPED)
+    {
+        kill(-pid, SIGCONT);
+        TRACE(TRACE_CONTINUE, 0, pid, job->jobCount, 0);
+    }
+    job->jobStatus = RUNNING;
+
+    waitForJob(job->process);
+
+    signal(SIGTTOU, SIG_IGN);
+    tcsetpgrp(0, getpid());
+    signal(SIGTTOU, SIG_DFL);
+    TRACE(TRACE_TERMINAL, 0, getpid(), job->jobCount, 0);
+
+    if (isJobStopped(job->process))
+    {
+        job->jobStatus = STOPPED;
+        touchJob(job);
+        printf("\n");
+        printJob(job);
+        return 128 + SIGTSTP;
+    }
+    status = getExitStatus(job->process);
+    removeJob(job);
+    return status;
+}
+
+/** The bg builtin: continues the stopped job in the background**/
+int backgroundJob(char **args)
+{
+    struct job *job;
+    struct processList *proc;
+
+    if (!interactive)
+    {
+        fprintf(stderr, "yash: bg: no job control\n");
+        return 1;
+    }
+    if ((job = parseJobSpec(args[1], "bg")) == NULL)
+    {
+        return 1;
+    }
+    if (job->jobStatus != STOPPED)
+    {
+        fprintf(stderr, "yash: bg: job %d already in background\n", job->jobCount);
+        return 0;
+    }
+
+    for (proc = job->process; proc != NULL; proc = proc->next)
+    {
+        proc->stopped = false;
+    }
+    // the continue notification is picked up by the reaper, there is no need to wait for it here
+    job->jobStatus = RUNNING;
+    kill(-job->process->groupId, SIGCONT);
+    TRACE(TRACE_CONTINUE, 0, job->process->groupId, job->jobCount, 0);
+    printf("[%d] %s %s\n", job->jobCount, getJobSign(job), job->jobCommand);
+    return 0;
+}
+
+/** This function waits until the jobs are done or stopped: all of them, or with any the first one. The pidfd of
+ * every stage still running is polled together with the signalfd, which also reports stops, so the shell sleeps in
+ * poll until a child changes state and reaps exactly the children whose pidfd fired. In an interactive shell ^C ends
+ * the wait. Returns the job that ended a wait for any, or NULL when there is none or the wait was interrupted**/
+struct job *waitForJobs(struct job **jobs, int count, bool any)
+{
+    struct pollfd *fds = NULL;
+    struct processList **procs = NULL;
+    int capacity = 0;
+    int interruptFd = -1;
+    struct job *found = NULL;
+    sigset_t interruptSignal;
+
+    if (interactive)
+    {
+        // SIGINT is ignored by the shell, it has to be unignored and blocked to be read from a signalfd
+        sigemptyset(&interruptSignal);
+        sigaddset(&interruptSignal, SIGINT);
+        sigprocmask(SIG_BLOCK, &interruptSignal, NULL);
+        signal(SIGINT, SIG_DFL);
+        interruptFd = signalfd(-1, &interruptSignal, SFD_NONBLOCK | SFD_CLOEXEC);
+    }
+
+    while (1)
+    {
+        struct processList *proc;
+        int pending = 0;
+        int nfds = 0;
+        int index;
+
+        for (index = 0; index < count && found == NULL; index++)
+        {
+            if (jobs[index]->jobStatus != RUNNING)
+            {
+                found = any ? jobs[index] : NULL;
+                continue;
+            }
+            pending++;
+            for (proc = jobs[index]->process; proc != NULL; proc = proc->next)
+            {
+                if (proc->completed || proc->pidFd < 0)
+                {
+                    continue;
+                }
+                if (nfds + 2 >= capacity)
+                {
+                    capacity = capacity == 0 ? 16 : capacity * 2;
+                    fds = (struct pollfd *)realloc(fds, sizeof(struct pollfd) * capacity);
+                    procs = (struct processList **)realloc(procs, sizeof(struct processList *) * capacity);
+                }
+                procs[nfds] = proc;
+                fds[nfds].fd = proc->pidFd;
+                fds[nfds++].events = POLLIN;
+            }
+        }
+        if (found != NULL || pending == 0)
+        {
+            break;
+        }
+        if (nfds + 2 >= capacity)
+        {
+            capacity = nfds + 2;
+            fds = (struct pollfd *)realloc(fds, sizeof(struct pollfd) * capacity);
+            procs = (struct processList **)realloc(procs, sizeof(struct processList *) * capacity);
+        }
+        fds[nfds].fd = sigChildFd;
+        fds[nfds].events = POLLIN;
+        fds[nfds + 1].fd = interruptFd;
+        fds[nfds + 1].events = POLLIN;
+        if (poll(fds, nfds + (interruptFd >= 0 ? 2 : 1), -1) < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            break;
+        }
+        if (interruptFd >= 0 && (fds[nfds + 1].revents & POLLIN))
+        {
+            printf("\n");
+            break;
+        }
+        for (index = 0; index < nfds; index++)
+        {
+            struct rusage usage;
+            int status;
+
+            if ((fds[index].revents & POLLIN) && wait4(procs[index]->cpid, &status, WNOHANG, &usage) > 0)
+            {
+                updateProcessStatus(procs[index]->cpid, status, &usage);
+            }
+        }
+        if (fds[nfds].revents & POLLIN)
+        {
+            reapChildren();
+        }
+    }
+
+    if (interruptFd >= 0)
+    {
+        close(interruptFd);
+        signal(SIGINT, SIG_IGN);
+        sigprocmask(SIG_UNBLOCK, &interruptSignal, NULL);
+    }
+    free(fds);
+    free(procs);
+    return found;
+}
+
+/** This function returns the status of a finished or stopped job the way $? reports it**/
+int getJobStatus(struct job *job)
+{
+    return job->jobStatus == STOPPED ? 128 + SIGTSTP : getExitStatus(job->process);
+}
+
+/** The wait builtin: wait [-n] [%job | pid ...]. Without operands it waits for every job that is not stopped and
+ * returns 0, otherwise it waits for each given job and returns the status of the last one, or 127 if it is not a job
+ * of this shell. With -n it returns as soon as one of the jobs (or of all jobs) finishes, with its status. A job
+ * whose status was returned is removed from the job table**/
+int waitCommand(char **args)
+{
+    struct job **jobs;
+    struct job *found;
+    bool any = false;
+    bool operands;
+    int count = 0;
+    int index = 1;
+    int status = 0;
+
+    if (args[1] != NULL && strcmp(args[1], "-n") == 0)
+    {
+        any = true;
+        index++;
+    }
+    operands = args[index] != NULL;
+    // pick up jobs that finished since the last line
+    reapChildren();
+    jobs = (struct job **)arenaAlloc(&lineArena, sizeof(struct job *) * (globalJobNumber + 1));
+
+    if (!operands)
+    {
+        int number;
+
+        // a stopped job would never finish on its own
+        for (number = 1; number <= globalJobNumber; number++)
+        {
+            if (jobTable[number] != NULL && jobTable[number]->jobStatus != STOPPED)
+            {
+                jobs[count++] = jobTable[number];
+            }
+        }
+    }
+    for (; args[index] != NULL; index++)
+    {
+        struct job *job = NULL;
+
+        if (args[index][0] == '%')
+        {
+            job = parseJobSpec(args[index], "wait");
+        }
+        else
+        {
+            char *end;
+            pid_t pid = (pid_t)strtol(args[index], &end, 10);
+            struct pidEntry *entry = *end == '\0' && args[index][0] != '\0' ? findPid(pid) : NULL;
+
+            if (entry == NULL)
+            {
+                fprintf(stderr, "yash: wait: %s: not a child of this shell\n", args[index]);
+            }
+            job = entry != NULL ? entry->job : NULL;
+        }
+        if (job == NULL)
+        {
+            status = 127;
+            continue;
+        }
+        if (any)
+        {
+            jobs[count++] = job;
+            continue;
+        }
+        waitForJobs(&job, 1, false);
+        if (job->jobStatus == RUNNING)
+        {
+            return 128 + SIGINT;
+        }
+        status = getJobStatus(job);
+        if (job->jobStatus == DONE)
+        {
+            collectJob(job);
+        }
+    }
+
+    if (any)
+    {
+        if (count == 0)
+        {
+            return 127;
+        }
+        if ((found = waitForJobs(jobs, count, true)) == NULL)
+        {
+            return 128 + SIGINT;
+        }
+        status = getJobStatus(found);
+        if (found->jobStatus == DONE)
+        {
+            collectJob(found);
+        }
+        return status;
+    }
+    if (!operands)
+    {
+        waitForJobs(jobs, count, false);
+        for (index = 0; index < count; index++)
+        {
+            if (jobs[index]->jobStatus == RUNNING)
+            {
+                return 128 + SIGINT;
+            }
+        }
+        if (!interactive)
+        {
+            // a script learns nothing more about the jobs, at the prompt their Done messages are still due
+            for (index = 0; index < count; index++)
+            {
+                if (jobs[index]->jobStatus == DONE)
+                {
+                    collectJob(jobs[index]);
+                }
+            }
+        }
+    }
+    return status;
+}
+
+/** This function parses a duration: a decimal number of seconds with an optional s, m, h or d suffix**/
+bool parseDuration(const char *text, double *seconds)
+{
+    char *end;
+
+    errno = 0;
+    *seconds = strtod(text, &end);
+    if (end == text || errno != 0 || *seconds < 0)
+    {
+        return false;
+    }
+    if (*end == 'm')
+    {
+        *seconds *= 60;
+    }
+    else if (*end == 'h')
+    {
+        *seconds *= 3600;
+    }
+    else if (*end == 'd')
+    {
+        *seconds *= 86400;
+    }
+    else if (*end != 's' && *end != '\0')
+    {
+        return false;
+    }
+    return *end == '\0' || end[1] == '\0';
+}
+
+/** The timeout builtin: timeout [-k duration] [-s signal] duration command [arg ...] runs the command in a process
+ * group of its own and sends the signal (SIGTERM by default) to the group when the duration is over, then SIGKILL
+ * if it is still there after the -k duration (TIMEOUT_KILL_AFTER seconds by default). The shell waits in poll on the
+ * pidfd of the command with the time left as the poll timeout, so there is no sleeping and no helper process.
+ * Returns 124 if the command timed out (137 if it had to be killed), otherwise its status. A command stopped with ^Z
+ * becomes a stopped job without a deadline**/
+int timeoutCommand(char **args)
+{
+    struct processList *process;
+    struct timespec now;
+    double duration;
+    double killAfter = TIMEOUT_KILL_AFTER;
+    double deadline;
+    bool timedOut = false;
+    bool killed = false;
+    int sig = SIGTERM;
+    int index = 1;
+    int pidFd;
+
+    for (; args[index] != NULL && args[index][0] == '-' && args[index][1] != '\0'; index += 2)
+    {
+        if (strcmp(args[index], "--") == 0)
+        {
+            index++;
+            break;
+        }
+        if (strcmp(args[index], "-k") == 0 && args[index + 1] != NULL && parseDuration(args[index + 1], &killAfter))
+        {
+            continue;
+        }
+        if (strcmp(args[index], "-s") == 0 && args[index + 1] != NULL && (sig = getSignalNumber(args[index + 1])) > 0)
+        {
+            continue;
+        }
+        fprintf(stderr, "yash: timeout: usage: timeout [-k duration] [-s signal] duration command [arg ...]\n");
+        return 125;
+    }
+    if (args[index] == NULL || args[index + 1] == NULL || !parseDuration(args[index], &duration))
+    {
+        fprintf(stderr, "yash: timeout: usage: timeout [-k duration] [-s signal] duration command [arg ...]\n");
+        return 125;
+    }
+    index++;
+
+    process = (struct processList *)arenaAlloc(&lineArena, sizeof(struct processList));
+    memset(process, 0, sizeof(struct processList));
+    process->processArgs = args + index;
+    process->ownGroup = true;
+    // the command line of the job it becomes if it is stopped
+    process->processString = joinArgs(process->processArgs);
+
+    fflush(stdout);
+    nextStageInput = 0;
+    if (exexuteCommands(process, 0, 1) < 0)
+    {
+        return 127;
+    }
+    pidFd = openPidFd(process->cpid);
+    if (interactive)
+    {
+        tcsetpgrp(0, process->groupId);
+        TRACE(TRACE_TERMINAL, 0, process->groupId, 0, 0);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    deadline = now.tv_sec + now.tv_nsec / 1e9 + duration;
+
+    while (!process->completed && !process->stopped)
+    {
+        struct pollfd fds[2];
+        struct signalfd_siginfo info;
+        struct rusage usage;
+        double left;
+        int status;
+        int nfds = 0;
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        left = deadline - (now.tv_sec + now.tv_nsec / 1e9);
+        if (!killed && left <= 0)
+        {
+            if (!timedOut)
+            {
+                timedOut = true;
+                kill(-process->groupId, sig);
+                if (sig != SIGKILL)
+                {
+                    kill(-process->groupId, SIGCONT);
+                }
+                deadline += killAfter;
+                left = killAfter;
+            }
+            else
+            {
+                killed = true;
+                kill(-process->groupId, SIGKILL);
+            }
+        }
+        if (pidFd >= 0)
+        {
+            fds[nfds].fd = pidFd;
+            fds[nfds++].events = POLLIN;
+        }
+        fds[nfds].fd = sigChildFd;
+        fds[nfds++].events = POLLIN;
+        // the time left is rounded up so the deadline is never polled for too early, and a deadline more than
+        // INT_MAX ms away is polled for in steps
+        if (poll(fds, nfds, killed ? -1 : left * 1000 < INT_MAX - 1 ? (int)(left * 1000) + 1 : INT_MAX) < 0 &&
+            errno != EINTR)
+        {
+            break;
+        }
+        // the signalfd only wakes the loop up, other children are reaped by the main loop later
+        while (read(sigChildFd, &info, sizeof(info)) == sizeof(info))
+        {
+        }
+        if (wait4(process->cpid, &status, WNOHANG | WUNTRACED, &usage) == process->cpid)
+        {
+            process->status = status;
+            process->usage = usage;
+            process->stopped = WIFSTOPPED(status);
+            process->completed = !process->stopped;
+        }
+    }
+    if (pidFd >= 0)
+    {
+        close(pidFd);
+    }
+
+    if (interactive)
+    {
+        signal(SIGTTOU, SIG_IGN);
+        tcsetpgrp(0, getpid());
+        signal(SIGTTOU, SIG_DFL);
+        TRACE(TRACE_TERMINAL, 0, getpid(), 0, 0);
+    }
+    if (process->stopped)
+    {
+        printf("\n");
+        printJob(addJob(process, STOPPED));
+        return 128 + SIGTSTP;
+    }
+    if (timedOut)
+    {
+        return killed ? 128 + SIGKILL : 124;
+    }
+    return getExitStatus(process);
+}
+
+/** This function joins the arguments with blanks into one string in the line arena**/
+char *joinArgs(char **args)
+{
+    size_t length = 1;
+    char *text;
+    int index;
+
+    for (index = 0; args[index] != NULL; index++)
+    {
+        length += strlen(args[index]) + 1;
+    }
+    text = (char *)arenaAlloc(&lineArena, length);
+    for (length = 0, index = 0; args[index] != NULL; index++)
+    {
+        size_t argLength = strlen(args[index]);
+
+        if (index > 0)
+        {
+            text[length++] = ' ';
+        }
+        memcpy(text + length, args[index], argLength);
+        length += argLength;
+    }
+    text[length] = '\0';
+    return text;
+}
+
+/** This function parses a CPU list such as 0-3,6 into the set**/
+bool parseCpuList(const char *text, cpu_set_t *cpus)
+{
+    CPU_ZERO(cpus);
+    while (1)
+    {
+        char *end;
+        long first = strtol(text, &end, 10);
+        long last = first;
+
+        if (end == text || first < 0)
+        {
+            return false;
+        }
+        if (*end == '-')
+        {
+            text = end + 1;
+            last = strtol(text, &end, 10);
+            if (end == text || last < first)
+            {
+                return false;
+            }
+        }
+        if (last >= CPU_SETSIZE)
+        {
+            return false;
+        }
+        for (; first <= last; first++)
+        {
+            CPU_SET(first, cpus);
+        }
+        if (*end == '\0')
+        {
+            return true;
+        }
+        if (*end != ',')
+        {
+            return false;
+        }
+        text = end + 1;
+    }
+}
+
+/** This function parses an I/O priority: a class (realtime, best-effort or idle, or 1 to 3) with an optional :level
+ * from 0 (highest) to 7**/
+bool parseIoPriority(const char *text, int *ioprio)
+{
+    static const char *classes[] = {"realtime", "best-effort", "idle"};
+    const char *colon = strchrnul(text, ':');
+    size_t length = colon - text;
+    int ioClass = 0;
+    long level = 4;
+    int index;
+
+    for (index = 0; index < 3; index++)
+    {
+        if ((strlen(classes[index]) == length && strncmp(text, classes[index], length) == 0) ||
+            (length == 1 && *text == '1' + index))
+        {
+            ioClass = index + 1;
+        }
+    }
+    if (ioClass == 0)
+    {
+        return false;
+    }
+    if (*colon == ':')
+    {
+        char *end;
+
+        level = strtol(colon + 1, &end, 10);
+        if (end == colon + 1 || *end != '\0' || level < 0 || level > 7)
+        {
+            return false;
+        }
+    }
+    // the idle class has no levels
+    *ioprio = ioClass << IOPRIO_CLASS_SHIFT | (ioClass == 3 ? 0 : (int)level);
+    return true;
+}
+
+/** This function parses a resource=value limit, the value being a number or unlimited, and adds it to the placement**/
+bool parseLimit(const char *text, struct placement *placement)
+{
+    const char *equals = strchr(text, '=');
+    rlim_t value = RLIM_INFINITY;
+    int index;
+
+    if (equals == NULL || placement->limitCount >= PLACEMENT_MAX_LIMITS)
+    {
+        return false;
+    }
+    if (strcmp(equals + 1, "unlimited") != 0)
+    {
+        char *end;
+
+        errno = 0;
+        value = (rlim_t)strtoull(equals + 1, &end, 10);
+        if (end == equals + 1 || *end != '\0' || errno != 0)
+        {
+            return false;
+        }
+    }
+    for (index = 0; limitNames[index].name != NULL; index++)
+    {
+        if (strlen(limitNames[index].name) == (size_t)(equals - text) &&
+            strncmp(limitNames[index].name, text, equals - text) == 0)
+        {
+            placement->resources[placement->limitCount] = limitNames[index].resource;
+            placement->limits[placement->limitCount++] = value;
+            return true;
+        }
+    }
+    return false;
+}
+
+/** This function applies the placement to the process (0 for the calling one): CPU affinity, nice value, I/O priority
+ * and limits. A limit sets the soft limit and only raises the hard limit when it has to. Prints an error and returns
+ * false at the first setting that fails**/
+bool applyPlacement(pid_t pid, struct placement *placement)
+{
+    int index;
+
+    if (placement->setAffinity && sched_setaffinity(pid, sizeof(cpu_set_t), &placement->cpus) < 0)
+    {
+        fprintf(stderr, "yash: jobctl: affinity: %s\n", strerror(errno));
+        return false;
+    }
+    if (placement->setNice && setpriority(PRIO_PROCESS, pid, placement->nice) < 0)
+    {
+        fprintf(stderr, "yash: jobctl: nice: %s\n", strerror(errno));
+        return false;
+    }
+    if (placement->ioprio >= 0 && syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, pid, placement->ioprio) < 0)
+    {
+        fprintf(stderr, "yash: jobctl: ioprio: %s\n", strerror(errno));
+        return false;
+    }
+    for (index = 0; index < placement->limitCount; index++)
+    {
+        struct rlimit limit;
+
+        // the hard limit is kept unless the new soft limit is above it
+        if (prlimit(pid, placement->resources[index], NULL, &limit) < 0)
+        {
+            fprintf(stderr, "yash: jobctl: limit: %s\n", strerror(errno));
+            return false;
+        }
+        limit.rlim_cur = placement->limits[index];
+        if (limit.rlim_max != RLIM_INFINITY && (limit.rlim_cur == RLIM_INFINITY || limit.rlim_cur > limit.rlim_max))
+        {
+            limit.rlim_max = limit.rlim_cur;
+        }
+        if (prlimit(pid, placement->resources[index], &limit, NULL) < 0)
+        {
+            fprintf(stderr, "yash: jobctl: limit: %s\n", strerror(errno));
+            return false;
+        }
+    }
+    return true;
+}
+
+/** The jobctl builtin: jobctl [-c cpus] [-n nice] [-i class[:level]] [-l resource=value ...] command [arg ...] runs
+ * the command with the placement applied in the child before exec; jobctl [options] %job ... applies it to every
+ * running stage of the jobs, the nice value to their whole process group. In a forked copy of the shell (a pipeline
+ * stage or a background job) the placement is applied to the copy itself, which then becomes the command, so the
+ * job keeps its process**/
+int jobControlCommand(char **args)
+{
+    struct placement placement;
+    struct processList *process;
+    struct builtin *builtin;
+    int index = 1;
+    int status = 0;
+    bool valid = true;
+
+    memset(&placement, 0, sizeof(struct placement));
+    placement.ioprio = -1;
+    for (; valid && args[index] != NULL && args[index][0] == '-' && args[index][1] != '\0'; index += 2)
+    {
+        const char *value = args[index + 1];
+
+        if (strcmp(args[index], "--") == 0)
+        {
+            index++;
+            break;
+        }
+        if (value == NULL || args[index][2] != '\0')
+        {
+            valid = false;
+        }
+        else if (args[index][1] == 'c')
+        {
+            valid = placement.setAffinity = parseCpuList(value, &placement.cpus);
+        }
+        else if (args[index][1] == 'n')
+        {
+            char *end;
+
+            placement.nice = (int)strtol(value, &end, 10);
+            valid = placement.setNice = end != value && *end == '\0';
+        }
+        else if (args[index][1] == 'i')
+        {
+            valid = parseIoPriority(value, &placement.ioprio);
+        }
+        else if (args[index][1] == 'l')
+        {
+            valid = parseLimit(value, &placement);
+        }
+        else
+        {
+            valid = false;
+        }
+    }
+    if (!valid || args[index] == NULL)
+    {
+        fprintf(stderr, "yash: jobctl: usage: jobctl [-c cpus] [-n nice] [-i class[:level]] [-l resource=value] "
+                        "command [arg ...] | %%job ...\n");
+        return 2;
+    }
+
+    if (args[index][0] == '%')
+    {
+        for (; args[index] != NULL; index++)
+        {
+            struct job *job = parseJobSpec(args[index], "jobctl");
+            struct placement stagePlacement = placement;
+            struct processList *proc;
+
+            if (job == NULL)
+            {
+                status = 1;
+                continue;
+            }
+            // the nice value is set for the whole process group of the job, so that the processes its stages have
+            // started get it as well; affinity, I/O priority and limits can only be set per process
+            if (placement.setNice && job->jobId > 0 && job->jobId != getpgrp() && getpgid(job->jobId) == job->jobId)
+            {
+                if (setpriority(PRIO_PGRP, job->jobId, placement.nice) < 0)
+                {
+                    fprintf(stderr, "yash: jobctl: nice: %s\n", strerror(errno));
+                    status = 1;
+                }
+                stagePlacement.setNice = false;
+            }
+            for (proc = job->process; proc != NULL; proc = proc->next)
+            {
+                if (!proc->completed && proc->cpid > 0 && !applyPlacement(proc->cpid, &stagePlacement))
+                {
+                    status = 1;
+                }
+            }
+        }
+        return status;
+    }
+
+    builtin = findBuiltin(args[index]);
+    if (getpid() != shellPid)
+    {
+        char *commandPath;
+
+        if (!applyPlacement(0, &placement))
+        {
+            return 126;
+        }
+        if (builtin != NULL)
+        {
+            return builtin->handler(args + index);
+        }
+        if ((commandPath = lookupCommandPath(args[index])) == NULL)
+        {
+            fprintf(stderr, "yash: %s: command not found\n", args[index]);
+            return 127;
+        }
+        fflush(stdout);
+        execve(commandPath, args + index, exportedEnv);
+        fprintf(stderr, "yash: %s: %s\n", args[index], strerror(errno));
+        return 126;
+    }
+
+    // in the shell itself the command becomes a foreground job of its own
+    process = (struct processList *)arenaAlloc(&lineArena, sizeof(struct processList));
+    memset(process, 0, sizeof(struct processList));
+    process->processArgs = args + index;
+    process->processString = joinArgs(args + index);
+    process->placement = (struct placement *)arenaAlloc(&lineArena, sizeof(struct placement));
+    *process->placement = placement;
+    return executeParsedCommand(process, fg);
+}
+
+/** This function sends the signal to the job: to its process group with job control, otherwise to each of its
+ * stages that is still running**/
+void signalJob(struct job *job, int sig)
+{
+    struct processList *proc;
+
+    if (interactive)
+    {
+        kill(-job->process->groupId, sig);
+        return;
+    }
+    for (proc = job->process; proc != NULL; proc = proc->next)
+    {
+        if (!proc->completed)
+        {
+            kill(proc->cpid, sig);
+        }
+    }
+}
+
+/** This function returns the next command for the parallel builtin in a malloc'd string: the next argument, or
+ * without arguments the next non-empty line of stdin, which is read in chunks as the commands are needed so that
+ * tasks start while the input is still arriving. Returns NULL when there are no more**/
+char *nextTaskCommand(char **args, int *argIndex, struct textBuffer *input, size_t *inputStart, bool *inputEnd)
+{
+    if (args[0] != NULL)
+    {
+        return args[*argIndex] != NULL ? strdup(args[(*argIndex)++]) : NULL;
+    }
+    while (1)
+    {
+        char *line = input->data != NULL ? (char *)memchr(input->data + *inputStart, '\n', input->length - *inputStart)
+                                         : NULL;
+        char chunk[SUBSTITUTION_READ_SIZE];
+        ssize_t count;
+
+        if (line != NULL || (*inputEnd && *inputStart < input->length))
+        {
+            size_t end = line != NULL ? (size_t)(line - input->data) : input->length;
+            char *command = strndup(input->data + *inputStart, end - *inputStart);
+
+            *inputStart = line != NULL ? end + 1 : end;
+            if (strspn(command, " \t") == strlen(command))
+            {
+                free(command);
+                continue;
+            }
+            return command;
+        }
+        if (*inputEnd)
+        {
+            return NULL;
+        }
+        if (*inputStart > 0)
+        {
+            // drop the lines already handed out
+            memmove(input->data, input->data + *inputStart, input->length - *inputStart);
+            input->length -= *inputStart;
+            *inputStart = 0;
+        }
+        if ((count = read(STDIN_FILENO, chunk, sizeof(chunk))) < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (count <= 0)
+        {
+            *inputEnd = true;
+            continue;
+        }
+        appendText(input, chunk, count);
+    }
+}
+
+/** This function starts the command of the task in a forked copy of the shell and adds it to the job table as a
+ * background job. With capture its stdout goes to a memfd that is printed when it is done; with nullInput its stdin
+ * is /dev/null. Returns the job or NULL**/
+struct job *startTask(struct parallelTask *task, bool capture, bool nullInput)
+{
+    struct processList process;
+    pid_t pid;
+
+    task->outputFd = -1;
+    if (capture && (task->outputFd = memfd_create("yash-parallel", MFD_CLOEXEC)) < 0)
+    {
+        perror("yash: parallel: memfd_create");
+        return NULL;
+    }
+    fflush(stdout);
+    if ((pid = fork()) < 0)
+    {
+        perror("yash: parallel: fork");
+        return NULL;
+    }
+    if (pid == 0)
+    {
+        prepareChild(0);
+        interactive = false;
+        if (nullInput)
+        {
+            int fd = open("/dev/null", O_RDONLY);
+
+            dup2(fd, STDIN_FILENO);
+            close(fd);
+        }
+        if (task->outputFd >= 0)
+        {
+            dup2(task->outputFd, STDOUT_FILENO);
+            close(task->outputFd);
+        }
+        tailPosition = true;
+        parsecommands(task->command, true);
+        fflush(stdout);
+        if (traceEnabled)
+        {
+            flushTrace();
+        }
+        _exit(lastExitStatus);
+    }
+
+    if (interactive)
+    {
+        setpgid(pid, pid);
+    }
+    memset(&process, 0, sizeof(struct processList));
+    process.processString = task->command;
+    process.cpid = pid;
+    process.groupId = pid;
+    TRACE(TRACE_FORK, pid, pid, 0, 0);
+    return addJob(&process, RUNNING);
+}
+
+/** This function moves the collected output of the finished task from its memfd to memory and closes the memfd,
+ * so that the tasks waiting for their turn with -k do not hold a descriptor each**/
+void spoolTaskOutput(struct parallelTask *task)
+{
+    char chunk[SUBSTITUTION_READ_SIZE];
+    ssize_t count;
+
+    if (task->outputFd < 0)
+    {
+        return;
+    }
+    lseek(task->outputFd, 0, SEEK_SET);
+    while ((count = read(task->outputFd, chunk, sizeof(chunk))) > 0 || (count < 0 && errno == EINTR))
+    {
+        appendText(&task->output, chunk, count > 0 ? count : 0);
+    }
+    close(task->outputFd);
+    task->outputFd = -1;
+}
+
+/** This function copies the collected output of the task to stdout and releases it**/
+void printTaskOutput(struct parallelTask *task)
+{
+    size_t written = 0;
+
+    spoolTaskOutput(task);
+    fflush(stdout);
+    while (written < task->output.length)
+    {
+        ssize_t result = write(STDOUT_FILENO, task->output.data + written, task->output.length - written);
+
+        if (result < 0 && errno != EINTR)
+        {
+            break;
+        }
+        written += result > 0 ? result : 0;
+    }
+    free(task->output.data);
+    task->output.data = NULL;
+    task->output.length = 0;
+}
+
+/** The parallel builtin: parallel [-j slots] [-k | -u] [command ...] runs the commands, or the lines of stdin if
+ * there are none, as background jobs with at most slots of them (the number of CPUs by default) running at a time.
+ * The next command starts as soon as a running one finishes, which the shell learns from the pidfd wait. The output
+ * of each command is collected and printed in one piece when it is done, in the order the commands finish, or in the
+ * order they were given with -k; -u lets the commands write directly. Every command that fails is reported with its
+ * status; the status is the number of failed commands (at most PARALLEL_MAX_FAILURES)**/
+int parallelCommand(char **args)
+{
+    struct parallelTask *tasks = NULL;
+    struct job **running;
+    struct textBuffer input = {NULL, 0, 0};
+    size_t inputStart = 0;
+    bool inputEnd = false;
+    bool ordered = false;
+    bool capture = true;
+    bool stopped = false;
+    long slots = sysconf(_SC_NPROCESSORS_ONLN);
+    int taskCount = 0;
+    int taskCapacity = 0;
+    int runningCount = 0;
+    int printed = 0;
+    int failures = 0;
+    int argIndex = 0;
+    int taskIndex;
+    int index = 1;
+
+    for (; args[index] != NULL && args[index][0] == '-' && args[index][1] != '\0'; index++)
+    {
+        if (strcmp(args[index], "--") == 0)
+        {
+            index++;
+            break;
+        }
+        if (strcmp(args[index], "-k") == 0)
+        {
+            ordered = true;
+        }
+        else if (strcmp(args[index], "-u") == 0)
+        {
+            capture = false;
+        }
+        else if (strcmp(args[index], "-j") == 0 && args[index + 1] != NULL)
+        {
+            char *end;
+
+            slots = strtol(args[++index], &end, 10);
+            if (*end != '\0' || slots < 1)
+            {
+                fprintf(stderr, "yash: parallel: %s: invalid number of jobs\n", args[index]);
+                return 2;
+            }
+        }
+        else
+        {
+            fprintf(stderr, "yash: parallel: usage: parallel [-j slots] [-k | -u] [command ...]\n");
+            return 2;
+        }
+    }
+    args += index;
+    running = (struct job **)malloc(sizeof(struct job *) * slots);
+
+    while (1)
+    {
+        struct job *found;
+        struct parallelTask *task = NULL;
+        char *command;
+
+        while (!stopped && runningCount < slots &&
+               (command = nextTaskCommand(args, &argIndex, &input, &inputStart, &inputEnd)) != NULL)
+        {
+            if (taskCount >= taskCapacity)
+            {
+                taskCapacity = taskCapacity == 0 ? 64 : taskCapacity * 2;
+                tasks = (struct parallelTask *)realloc(tasks, sizeof(struct parallelTask) * taskCapacity);
+            }
+            task = &tasks[taskCount++];
+            task->command = command;
+            task->finished = false;
+            task->status = 0;
+            task->output.data = NULL;
+            task->output.length = 0;
+            task->output.capacity = 0;
+            // a command reading the terminal from the background would be stopped
+            if ((task->job = startTask(task, capture, args[0] == NULL || isatty(STDIN_FILENO))) == NULL)
+            {
+                task->finished = true;
+                task->status = 126;
+                failures++;
+                continue;
+            }
+            running[runningCount++] = task->job;
+        }
+        if (runningCount == 0)
+        {
+            break;
+        }
+
+        if ((found = waitForJobs(running, runningCount, true)) == NULL)
+        {
+            // ^C: the commands still running are terminated and no new ones are started
+            for (index = 0; index < runningCount; index++)
+            {
+                signalJob(running[index], SIGTERM);
+            }
+            stopped = true;
+            continue;
+        }
+        if (found->jobStatus == STOPPED)
+        {
+            signalJob(found, SIGKILL);
+            signalJob(found, SIGCONT);
+            continue;
+        }
+
+        for (taskIndex = 0; taskIndex < taskCount && tasks[taskIndex].job != found; taskIndex++)
+        {
+        }
+        task = &tasks[taskIndex];
+        task->status = getJobStatus(found);
+        task->finished = true;
+        task->job = NULL;
+        collectJob(found);
+        for (index = 0; index < runningCount && running[index] != found; index++)
+        {
+        }
+        running[index] = running[--runningCount];
+
+        if (task->status != 0)
+        {
+            failures++;
+            fprintf(stderr, "yash: parallel: exit %d: %s\n", task->status, task->command);
+        }
+        if (!ordered)
+        {
+            printTaskOutput(task);
+        }
+        for (; ordered && printed < taskCount && tasks[printed].finished; printed++)
+        {
+            printTaskOutput(&tasks[printed]);
+        }
+        if (taskIndex >= printed)
+        {
+            spoolTaskOutput(task);
+        }
+    }
+
+    for (index = 0; index < taskCount; index++)
+    {
+        printTaskOutput(&tasks[index]);
+        free(tasks[index].command);
+    }
+    free(tasks);
+    free(running);
+    free(input.data);
+    if (stopped)
+    {
+        return 128 + SIGINT;
+    }
+    return failures < PARALLEL_MAX_FAILURES ? failures : PARALLEL_MAX_FAILURES;
+}
+
+/** This function returns how much of the execve argument space the exported environment takes: the strings and
+ * their pointers**/
+size_t environmentSize()
+{
+    size_t size = sizeof(char *);
+    char **env;
+
+    for (env = exportedEnv != NULL ? exportedEnv : environ; *env != NULL; env++)
+    {
+        size += strlen(*env) + 1 + sizeof(char *);
+    }
+    return size;
+}
+
+/** This function runs the command with the itemCount NUL terminated items packed in items appended to its arguments
+ * and adds it to the job table as a background job. Empty items are left out. Returns the job or NULL**/
+struct job *startBatch(char **command, int commandCount, char *commandPath, char *items, size_t length, int itemCount,
+                       int inputFd)
+{
+    struct processList process;
+    char **argv = (char **)malloc(sizeof(char *) * (commandCount + itemCount + 1));
+    char *item;
+    int count = commandCount;
+    TraceEventType launch = TRACE_SPAWN;
+    pid_t pid = -1;
+
+    memcpy(argv, command, sizeof(char *) * commandCount);
+    for (item = items; item < items + length; item += strlen(item) + 1)
+    {
+        if (*item != '\0')
+        {
+            argv[count++] = item;
+        }
+    }
+    argv[count] = NULL;
+
+    memset(&process, 0, sizeof(struct processList));
+    process.processString = command[0];
+    process.processArgs = argv;
+    // the same choice as for any command: posix_spawn unless YASH_LAUNCH=fork, fork and execve when it fails
+    if (useSpawn)
+    {
+        pid = spawnProcess(&process, commandPath, inputFd, STDOUT_FILENO);
+    }
+    if (pid < 0 && (!useSpawn || (errno != ENOENT && errno != EACCES && errno != ENOTDIR)))
+    {
+        launch = TRACE_FORK;
+        pid = forkProcess(&process, commandPath, inputFd, STDOUT_FILENO);
+    }
+    free(argv);
+    if (pid < 0)
+    {
+        fprintf(stderr, "yash: xargs: %s: %s\n", command[0], strerror(errno));
+        return NULL;
+    }
+    process.cpid = pid;
+    process.groupId = pid;
+    TRACE(launch, pid, pid, 0, 0);
+    return addJob(&process, RUNNING);
+}
+
+/** This function waits until one of the running batches is done and removes it from running and the job table.
+ * The xargs status in status is raised to 123 if the batch failed, 124 if it exited with 255, 125 if it was killed
+ * and 130 if the wait was interrupted, in which case the running batches are terminated. Returns false if no more
+ * batches should be started**/
+bool finishBatch(struct job **running, int *runningCount, int *status)
+{
+    struct job *found;
+    int result;
+    int index;
+
+    while ((found = waitForJobs(running, *runningCount, true)) != NULL && found->jobStatus == STOPPED)
+    {
+        signalJob(found, SIGKILL);
+        signalJob(found, SIGCONT);
+    }
+    if (found == NULL)
+    {
+        for (index = 0; index < *runningCount; index++)
+        {
+            signalJob(running[index], SIGTERM);
+        }
+        *status = 128 + SIGINT;
+        return false;
+    }
+    result = getJobStatus(found);
+    collectJob(found);
+    for (index = 0; index < *runningCount && running[index] != found; index++)
+    {
+    }
+    running[index] = running[--*runningCount];
+
+    result = result == 0 ? 0 : result == 255 ? 124 : result > 128 ? 125 : 123;
+    *status = result > *status ? result : *status;
+    return result < 124;
+}
+
+/** The xargs builtin: xargs [-0] [-n max] [-P procs] [command [arg ...]] reads items from stdin, one per line or
+ * NUL terminated with -0, and runs the command (echo by default) with as many of them appended as fit in one
+ * execve: sysconf(_SC_ARG_MAX) less the environment and XARGS_HEADROOM, or at most max of them. Up to procs
+ * commands run at a time as background jobs. Empty items are skipped and without items the command is not run.
+ * The status is 123 if a command failed, 124 if one exited with 255 and 125 if one was killed, after which no
+ * more commands are started, 126 or 127 if the command cannot be run**/
+int xargsCommand(char **args)
+{
+    struct textBuffer input = {NULL, 0, 0};
+    struct job **running;
+    char *defaultCommand[] = {"echo", NULL};
+    char **command;
+    char *commandPath;
+    char separator = '\n';
+    long argMax = sysconf(_SC_ARG_MAX);
+    long maxItems = LONG_MAX;
+    long slots = 1;
+    size_t limit;
+    size_t baseSize = 0;
+    size_t batchSize;
+    size_t itemStart = 0;
+    int commandCount;
+    int itemCount = 0;
+    int runningCount = 0;
+    int status = 0;
+    int inputFd;
+    int index = 1;
+    bool inputEnd = false;
+    bool stopped = false;
+
+    for (; args[index] != NULL && args[index][0] == '-' && args[index][1] != '\0'; index++)
+    {
+        if (strcmp(args[index], "--") == 0)
+        {
+            index++;
+            break;
+        }
+        if (strcmp(args[index], "-0") == 0)
+        {
+            separator = '\0';
+        }
+        else if ((strcmp(args[index], "-n") == 0 || strcmp(args[index], "-P") == 0) && args[index + 1] != NULL)
+        {
+            char *end;
+            long value = strtol(args[index + 1], &end, 10);
+
+            if (*end != '\0' || value < 1)
+            {
+                fprintf(stderr, "yash: xargs: %s: invalid number\n", args[index + 1]);
+                return 2;
+            }
+            *(args[index][1] == 'n' ? &maxItems : &slots) = value;
+            index++;
+        }
+        else
+        {
+            fprintf(stderr, "yash: xargs: usage: xargs [-0] [-n max] [-P procs] [command [arg ...]]\n");
+            return 2;
+        }
+    }
+    command = args[index] != NULL ? args + index : defaultCommand;
+    for (commandCount = 0; command[commandCount] != NULL; commandCount++)
+    {
+        baseSize += strlen(command[commandCount]) + 1 + sizeof(char *);
+    }
+    if ((commandPath = lookupCommandPath(command[0])) == NULL)
+    {
+        fprintf(stderr, "yash: xargs: %s: command not found\n", command[0]);
+        return 127;
+    }
+    if (argMax <= 0)
+    {
+        argMax = _POSIX_ARG_MAX;
+    }
+    baseSize += environmentSize() + XARGS_HEADROOM;
+    limit = (size_t)argMax > baseSize ? (size_t)argMax : baseSize;
+    batchSize = baseSize;
+    if ((inputFd = open("/dev/null", O_RDONLY | O_CLOEXEC)) < 0)
+    {
+        perror("yash: xargs: /dev/null");
+        return 1;
+    }
+    running = (struct job **)malloc(sizeof(struct job *) * slots);
+
+    // input holds the items of the next batch, NUL terminated, followed by the input not looked at yet
+    while (!stopped)
+    {
+        char *end = input.data != NULL ? (char *)memchr(input.data + itemStart, separator, input.length - itemStart)
+                                       : NULL;
+        size_t cost;
+
+        if (end == NULL)
+        {
+            char chunk[SUBSTITUTION_READ_SIZE];
+            ssize_t count;
+
+            if (inputEnd)
+            {
+                break;
+            }
+            if ((count = read(STDIN_FILENO, chunk, sizeof(chunk))) < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (count > 0)
+            {
+                appendText(&input, chunk, count);
+                continue;
+            }
+            inputEnd = true;
+            if (input.length > itemStart)
+            {
+                // the last item has no separator
+                appendText(&input, &separator, 1);
+            }
+            continue;
+        }
+
+        cost = (end - input.data - itemStart) + 1 + sizeof(char *);
+        if (end == input.data + itemStart)
+        {
+            *end = '\0';
+            itemStart++;
+            continue;
+        }
+        if (baseSize + cost > limit)
+        {
+            fprintf(stderr, "yash: xargs: argument list too long\n");
+            status = 1;
+            stopped = true;
+            break;
+        }
+        if (itemCount > 0 && (batchSize + cost > limit || itemCount >= maxItems))
+        {
+            struct job *job;
+
+            while (!stopped && runningCount >= slots)
+            {
+                stopped = !finishBatch(running, &runningCount, &status);
+            }
+            if (stopped)
+            {
+                break;
+            }
+            if ((job = startBatch(command, commandCount, commandPath, input.data, itemStart, itemCount, inputFd)) == NULL)
+            {
+                status = 126;
+                stopped = true;
+                break;
+            }
+            running[runningCount++] = job;
+            // the arguments were copied by execve, the batch is no longer needed
+            memmove(input.data, input.data + itemStart, input.length - itemStart);
+            input.length -= itemStart;
+            itemStart = 0;
+            itemCount = 0;
+            batchSize = baseSize;
+            continue;
+        }
+        *end = '\0';
+        itemStart = end - input.data + 1;
+        batchSize += cost;
+        itemCount++;
+    }
+
+    while (!stopped && itemCount > 0 && runningCount >= slots)
+    {
+        stopped = !finishBatch(running, &runningCount, &status);
+    }
+    if (!stopped && itemCount > 0)
+    {
+        struct job *job = startBatch(command, commandCount, commandPath, input.data, itemStart, itemCount, inputFd);
+
+        if (job != NULL)
+        {
+            running[runningCount++] = job;
+        }
+        else
+        {
+            status = 126;
+        }
+    }
+    while (runningCount > 0)
+    {
+        finishBatch(running, &runningCount, &status);
+    }
+
+    close(inputFd);
+    free(running);
+    free(input.data);
+    return status;
+}
+
+/** The jobs builtin: jobs [-lr] [jobspec ...] lists the given jobs or all of them; finished jobs are reported once
+ * and then dropped. -r only lists running jobs, -l adds the pid, state, CPU time and peak RSS of every stage and
+ * the totals of the job**/
+int listJobs(char **args)
+{
+    bool longFormat = false;
+    bool runningOnly = false;
+    int index = 1;
+    int status = 0;
+
+    for (; args[index] != NULL && args[index][0] == '-' && args[index][1] != '\0'; index++)
+    {
+        const char *flag = args[index] + 1;
+
+        if (strcmp(args[index], "--") == 0)
+        {
+            index++;
+            break;
+        }
+        for (; *flag; flag++)
+        {
+            if (*flag == 'l')
+            {
+                longFormat = true;
+            }
+            else if (*flag == 'r')
+            {
+                runningOnly = true;
+            }
+            else
+            {
+                fprintf(stderr, "yash: jobs: -%c: invalid option\nyash: jobs: usage: jobs [-lr] [jobspec ...]\n",
+                        *flag);
+                return 2;
+            }
+        }
+    }
+
+    // pick up jobs that finished since the prompt was last shown
+    reapChildren();
+    if (args[index] == NULL)
+    {
+        int number;
+
+        for (number = 1; number <= globalJobNumber; number++)
+        {
+            struct job *job = jobTable[number];
+
+            if (job != NULL && (!runningOnly || job->jobStatus == RUNNING))
+            {
+                printJob(job);
+                if (longFormat)
+                {
+                    printJobUsage(job);
+                }
+            }
+        }
+    }
+    for (; args[index] != NULL; index++)
+    {
+        struct job *job = parseJobSpec(args[index], "jobs");
+        if (job == NULL)
+        {
+            status = 1;
+            continue;
+        }
+        if (runningOnly && job->jobStatus != RUNNING)
+        {
+            continue;
+        }
+        printJob(job);
+        if (longFormat)
+        {
+            printJobUsage(job);
+        }
+    }
+    notifyDoneJobs(false);
+    return status;
+}
+
+/** This function returns a timeval as seconds**/
+double timevalSeconds(struct timeval tv)
+{
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+/** This function adds the resource usage of one process to the totals of a job or pipeline: CPU times and context
+ * switches add up, the peak RSS is the largest peak of any process**/
+void addUsage(struct rusage *total, const struct rusage *usage)
+{
+    timeradd(&total->ru_utime, &usage->ru_utime, &total->ru_utime);
+    timeradd(&total->ru_stime, &usage->ru_stime, &total->ru_stime);
+    if (usage->ru_maxrss > total->ru_maxrss)
+    {
+        total->ru_maxrss = usage->ru_maxrss;
+    }
+    total->ru_nvcsw += usage->ru_nvcsw;
+    total->ru_nivcsw += usage->ru_nivcsw;
+}
+
+/** wait4 only reports the usage of a process when it changes state, so for a stage that is still running this
+ * function reads the CPU time so far from /proc/<pid>/stat and the peak RSS from /proc/<pid>/status. Returns false
+ * if the process is gone**/
+bool readLiveUsage(pid_t pid, struct rusage *usage)
+{
+    char path[64];
+    char buffer[1024];
+    unsigned long utime;
+    unsigned long stime;
+    long ticks = sysconf(_SC_CLK_TCK);
+    char *field;
+    FILE *file;
+
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+    if ((file = fopen(path, "re")) == NULL)
+    {
+        return false;
+    }
+    field = fgets(buffer, sizeof(buffer), file);
+    fclose(file);
+    // the command name in the second field may contain spaces, the fields after it are numbers
+    if (field == NULL || (field = strrchr(buffer, ')')) == NULL ||
+        sscanf(field + 1, " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) != 2)
+    {
+        return false;
+    }
+    memset(usage, 0, sizeof(struct rusage));
+    usage->ru_utime.tv_sec = utime / ticks;
+    usage->ru_utime.tv_usec = (utime % ticks) * 1000000 / ticks;
+    usage->ru_stime.tv_sec = stime / ticks;
+    usage->ru_stime.tv_usec = (stime % ticks) * 1000000 / ticks;
+
+    snprintf(path, sizeof(path), "/proc/%d/status", (int)pid);
+    if ((file = fopen(path, "re")) != NULL)
+    {
+        while (fgets(buffer, sizeof(buffer), file) != NULL)
+        {
+            if (strncmp(buffer, "VmHWM:", 6) == 0)
+            {
+                usage->ru_maxrss = atol(buffer + 6);
+            }
+            else if (strncmp(buffer, "voluntary_ctxt_switches:", 24) == 0)
+            {
+                usage->ru_nvcsw = atol(buffer + 24);
+            }
+            else if (strncmp(buffer, "nonvoluntary_ctxt_switches:", 27) == 0)
+            {
+                usage->ru_nivcsw = atol(buffer + 27);
+            }
+        }
+        fclose(file);
+    }
+    return true;
+}
+
+/** This function prints one line per stage of the job for jobs -l: pid, state, CPU time and peak RSS, followed by
+ * the totals of the job**/
+void printJobUsage(struct job *job)
+{
+    struct processList *proc;
+    struct rusage total;
+
+    memset(&total, 0, sizeof(struct rusage));
+    for (proc = job->process; proc != NULL; proc = proc->next)
+    {
+        struct rusage usage = proc->usage;
+        char state[32];
+
+        if (proc->cpid <= 0)
+        {
+            continue;
+        }
+        if (!proc->completed)
+        {
+            readLiveUsage(proc->cpid, &usage);
+            snprintf(state, sizeof(state), "%s", proc->stopped ? "Stopped" : "Running");
+        }
+        else if (WIFSIGNALED(proc->status))
+        {
+            snprintf(state, sizeof(state), "Signal %d", WTERMSIG(proc->status));
+        }
+        else if (WEXITSTATUS(proc->status) != 0)
+        {
+            snprintf(state, sizeof(state), "Exit %d", WEXITSTATUS(proc->status));
+        }
+        else
+        {
+            snprintf(state, sizeof(state), "Done");
+        }
+        printf("      %-8d %-10s user %8.3fs  sys %8.3fs  maxrss %8ldK\n", (int)proc->cpid, state,
+               timevalSeconds(usage.ru_utime), timevalSeconds(usage.ru_stime), usage.ru_maxrss);
+        addUsage(&total, &usage);
+    }
+    printf("      %-8s %-10s user %8.3fs  sys %8.3fs  maxrss %8ldK\n", "total", "", timevalSeconds(total.ru_utime),
+           timevalSeconds(total.ru_stime), total.ru_maxrss);
+}
+
+/** This function prints the report of the time keyword on stderr in the format bash uses, followed by the peak RSS
+ * and the context switches of the pipeline**/
+void printTimeReport(double real, const struct rusage *usage)
+{
+    double user = timevalSeconds(usage->ru_utime);
+    double sys = timevalSeconds(usage->ru_stime);
+
+    fprintf(stderr, "\nreal\t%dm%.3fs\nuser\t%dm%.3fs\nsys\t%dm%.3fs\n", (int)(real / 60), real - (int)(real / 60) * 60,
+            (int)(user / 60), user - (int)(user / 60) * 60, (int)(sys / 60), sys - (int)(sys / 60) * 60);
+    fprintf(stderr, "maxrss\t%ldK\ncsw\t%ld voluntary, %ld involuntary\n", usage->ru_maxrss, usage->ru_nvcsw,
+            usage->ru_nivcsw);
+}
+
+/** This function returns the signal number for a signal name (with or without the SIG prefix) or number, or -1**/
+int getSignalNumber(const char *name)
+{
+    int index;
+    char *end;
+    int number = (int)strtol(name, &end, 10);
+
+    if (*name != '\0' && *end == '\0')
+    {
+        return number >= 0 && number < NSIG ? number : -1;
+    }
+    if (strncasecmp(name, "SIG", 3) == 0)
+    {
+        name += 3;
+    }
+    for (index = 0; signalNames[index].name != NULL; index++)
+    {
+        if (strcasecmp(signalNames[index].name, name) == 0)
+        {
+            return signalNames[index].number;
+        }
+    }
+    return -1;
+}
+
+/** The kill builtin: kill [-s sigspec | -n signum | -sigspec] pid | jobspec ... and kill -l. A job spec sends the
+ * signal to the whole process group of the job**/
+int killCommand(char **args)
+{
+    int sig = SIGTERM;
+    int index = 1;
+    int status = 0;
+
+    if (args[1] != NULL && strcmp(args[1], "-l") == 0)
+    {
+        for (index = 0; signalNames[index].name != NULL; index++)
+        {
+            printf("%2d) SIG%s\n", signalNames[index].number, signalNames[index].name);
+        }
+        return 0;
+    }
+    if (args[1] != NULL && (strcmp(args[1], "-s") == 0 || strcmp(args[1], "-n") == 0))
+    {
+        if (args[2] == NULL || (sig = getSignalNumber(args[2])) < 0)
+        {
+            fprintf(stderr, "yash: kill: %s: invalid signal specification\n", args[2] ? args[2] : "");
+            return 1;
+        }
+        index = 3;
+    }
+    else if (args[1] != NULL && args[1][0] == '-')
+    {
+        if ((sig = getSignalNumber(args[1] + 1)) < 0)
+        {
+            fprintf(stderr, "yash: kill: %s: invalid signal specification\n", args[1] + 1);
+            return 1;
+        }
+        index = 2;
+    }
+    if (args[index] == NULL)
+    {
+        fprintf(stderr, "yash: kill: usage: kill [-s sigspec | -n signum | -sigspec] pid | jobspec ... or kill -l\n");
+        return 2;
+    }
+
+    for (; args[index] != NULL; index++)
+    {
+        pid_t pid;
+
+        if (args[index][0] == '%')
+        {
+            struct job *job = parseJobSpec(args[index], "kill");
+            if (job == NULL)
+            {
+                status = 1;
+                continue;
+            }
+            if (!interactive)
+            {
+                // without job control the stages have no group of their own
+                struct processList *proc;
+                for (proc = job->process; proc != NULL; proc = proc->next)
+                {
+                    if (!proc->completed)
+                    {
+                        kill(proc->cpid, sig);
+                    }
+                }
+                continue;
+            }
+            pid = -job->process->groupId;
+            if (job->jobStatus == STOPPED && (sig == SIGTERM || sig == SIGHUP))
+            {
+                // a stopped job only sees the signal once it runs again
+                kill(pid, SIGCONT);
+            }
+        }
+        else
+        {
+            char *end;
+            pid = (pid_t)strtol(args[index], &end, 10);
+            if (*end != '\0' || args[index][0] == '\0')
+            {
+                fprintf(stderr, "yash: kill: %s: arguments must be process or job IDs\n", args[index]);
+                status = 1;
+                continue;
+            }
+        }
+        if (kill(pid, sig) < 0)
+        {
+            fprintf(stderr, "yash: kill: (%s) - %s\n", args[index], strerror(errno));
+            status = 1;
+        }
+    }
+    return status;
+}
+
+/** The exit builtin: exits with the given status or the status of the last command**/
+int exitCommand(char **args)
+{
+    fflush(stdout);
+    exit(args[1] != NULL ? atoi(args[1]) : lastExitStatus);
+}
+
+/** The cd builtin: changes to the given directory, $HOME without one or $OLDPWD for -, and updates PWD/OLDPWD**/
+int changeDirectory(char **args)
+{
+    const char *dir = args[1];
+    char *cwd;
+
+    if (dir == NULL)
+    {
+        if ((dir = getVariable("HOME")) == NULL)
+        {
+            fprintf(stderr, "yash: cd: HOME not set\n");
+            return 1;
+        }
+    }
+    else if (strcmp(dir, "-") == 0)
+    {
+        if ((dir = getVariable("OLDPWD")) == NULL)
+        {
+            fprintf(stderr, "yash: cd: OLDPWD not set\n");
+            return 1;
+        }
+        printf("%s\n", dir);
+    }
+
+    if (chdir(dir) < 0)
+    {
+        fprintf(stderr, "yash: cd: %s: %s\n", dir, strerror(errno));
+        return 1;
+    }
+    if (getVariable("PWD") != NULL)
+    {
+        setVariable("OLDPWD", getVariable("PWD"), false);
+    }
+    if ((cwd = getcwd(NULL, 0)) != NULL)
+    {
+        setVariable("PWD", cwd, false);
+        free(cwd);
+    }
+    return 0;
+}
+
+/** The pwd builtin**/
+int printWorkingDirectory(char **args)
+{
+    char *cwd = getcwd(NULL, 0);
+
+    if (cwd == NULL)
+    {
+        fprintf(stderr, "yash: pwd: %s\n", strerror(errno));
+        return 1;
+    }
+    printf("%s\n", cwd);
+    free(cwd);
+    return 0;
+}
+
+/** The echo builtin: echo [-neE] [arg ...]; -e turns on backslash escapes, -n drops the trailing newline**/
+int echoCommand(char **args)
+{
+    bool newline = true;
+    bool escapes = false;
+    int index = 1;
+
+    for (; args[index] != NULL && args[index][0] == '-' && args[index][1] != '\0'; index++)
+    {
+        const char *flag = args[index] + 1;
+
+        if (strspn(flag, "neE") != strlen(flag))
+        {
+            break;
+        }
+        for (; *flag; flag++)
+        {
+            if (*flag == 'n')
+            {
+                newline = false;
+            }
+            else
+            {
+                escapes = *flag == 'e';
+            }
+        }
+    }
+
+    for (; args[index] != NULL; index++)
+    {
+        const char *arg = args[index];
+
+        if (!escapes)
+        {
+            fputs(arg, stdout);
+        }
+        else
+        {
+            for (; *arg; arg++)
+            {
+                if (*arg != '\\' || arg[1] == '\0')
+                {
+                    putchar(*arg);
+                    continue;
+                }
+                switch (*++arg)
+                {
+                case 'n':
+                    putchar('\n');
+                    break;
+                case 't':
+                    putchar('\t');
+                    break;
+                case 'r':
+                    putchar('\r');
+                    break;
+                case 'a':
+                    putchar('\a');
+                    break;
+                case 'b':
+                    putchar('\b');
+                    break;
+                case 'f':
+                    putchar('\f');
+                    break;
+                case 'v':
+                    putchar('\v');
+                    break;
+                case 'e':
+                    putchar('\033');
+                    break;
+                case '\\':
+                    putchar('\\');
+                    break;
+                case 'c':
+                    // \c stops all further output
+                    return 0;
+                default:
+                    putchar('\\');
+                    putchar(*arg);
+                    break;
+                }
+            }
+        }
+        if (args[index + 1] != NULL)
+        {
+            putchar(' ');
+        }
+    }
+    if (newline)
+    {
+        putchar('\n');
+    }
+    return 0;
+}
+
+/** The true builtin**/
+int trueCommand(char **args)
+{
+    return 0;
+}
+
+/** The false builtin**/
+int falseCommand(char **args)
+{
+    return 1;
+}
+
+/** This function checks if the argument is a unary test operator**/
+bool isUnaryTest(const char *op)
+{
+    return op[0] == '-' && op[1] != '\0' && op[2] == '\0' && strchr("bcdefgGhLnprsStuwxzkO", op[1]) != NULL;
+}
+
+/** This function checks if the argument is a binary test operator**/
+bool isBinaryTest(const char *op)
+{
+    static const char *operators[] = {"=", "==", "!=", "<", ">", "-eq", "-ne", "-lt", "-le", "-gt", "-ge",
+                                      "-nt", "-ot", "-ef", NULL};
+    int index;
+
+    for (index = 0; operators[index] != NULL; index++)
+    {
+        if (strcmp(op, operators[index]) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/** This function converts a test operand to an integer, flagging an error if it is not one**/
+long testInteger(struct testState *state, const char *arg)
+{
+    char *end;
+    long value;
+
+    errno = 0;
+    value = strtol(arg, &end, 10);
+    while (*end == ' ' || *end == '\t')
+    {
+        end++;
+    }
+    if (*arg == '\0' || *end != '\0' || errno != 0)
+    {
+        fprintf(stderr, "yash: test: %s: integer expression expected\n", arg);
+        state->error = true;
+    }
+    return value;
+}
+
+/** This function evaluates a unary file or string test**/
+bool testUnary(struct testState *state, char op, const char *arg)
+{
+    struct stat sb;
+
+    switch (op)
+    {
+    case 'n':
+        return arg[0] != '\0';
+    case 'z':
+        return arg[0] == '\0';
+    case 't':
+        return isatty((int)testInteger(state, arg));
+    case 'h':
+    case 'L':
+        return lstat(arg, &sb) == 0 && S_ISLNK(sb.st_mode);
+    }
+
+    if (stat(arg, &sb) < 0)
+    {
+        return false;
+    }
+    switch (op)
+    {
+    case 'e':
+        return true;
+    case 'f':
+        return S_ISREG(sb.st_mode);
+    case 'd':
+        return S_ISDIR(sb.st_mode);
+    case 'b':
+        return S_ISBLK(sb.st_mode);
+    case 'c':
+        return S_ISCHR(sb.st_mode);
+    case 'p':
+        return S_ISFIFO(sb.st_mode);
+    case 'S':
+        return S_ISSOCK(sb.st_mode);
+    case 's':
+        return sb.st_size > 0;
+    case 'g':
+        return (sb.st_mode & S_ISGID) != 0;
+    case 'u':
+        return (sb.st_mode & S_ISUID) != 0;
+    case 'k':
+        return (sb.st_mode & S_ISVTX) != 0;
+    case 'O':
+        return sb.st_uid == geteuid();
+    case 'G':
+        return sb.st_gid == getegid();
+    case 'r':
+        return access(arg, R_OK) == 0;
+    case 'w':
+        return access(arg, W_OK) == 0;
+    case 'x':
+        return access(arg, X_OK) == 0;
+    }
+    return false;
+}
+
+/** This function evaluates a binary string, integer or file comparison**/
+bool testBinary(struct testState *state, const char *left, const char *op, const char *right)
+{
+    struct stat leftStat;
+    struct stat rightStat;
+
+    if (strcmp(op, "=") == 0 || strcmp(op, "==") == 0)
+    {
+        return strcmp(left, right) == 0;
+    }
+    if (strcmp(op, "!=") == 0)
+    {
+        return strcmp(left, right) != 0;
+    }
+    if (strcmp(op, "<") == 0)
+    {
+        return strcmp(left, right) < 0;
+    }
+    if (strcmp(op, ">") == 0)
+    {
+        return strcmp(left, right) > 0;
+    }
+    if (strcmp(op, "-nt") == 0 || strcmp(op, "-ot") == 0 || strcmp(op, "-ef") == 0)
+    {
+        bool haveLeft = stat(left, &leftStat) == 0;
+        bool haveRight = stat(right, &rightStat) == 0;
+
+        if (strcmp(op, "-ef") == 0)
+        {
+            return haveLeft && haveRight && leftStat.st_dev == rightStat.st_dev && leftStat.st_ino == rightStat.st_ino;
+        }
+        if (strcmp(op, "-nt") == 0)
+        {
+            return haveLeft && (!haveRight || leftStat.st_mtime > rightStat.st_mtime);
+        }
+        return haveRight && (!haveLeft || leftStat.st_mtime < rightStat.st_mtime);
+    }
+
+    long leftValue = testInteger(state, left);
+    long rightValue = testInteger(state, right);
+    if (strcmp(op, "-eq") == 0)
+    {
+        return leftValue == rightValue;
+    }
+    if (strcmp(op, "-ne") == 0)
+    {
+        return leftValue != rightValue;
+    }
+    if (strcmp(op, "-lt") == 0)
+    {
+        return leftValue < rightValue;
+    }
+    if (strcmp(op, "-le") == 0)
+    {
+        return leftValue <= rightValue;
+    }
+    if (strcmp(op, "-gt") == 0)
+    {
+        return leftValue > rightValue;
+    }
+    return leftValue >= rightValue;
+}
+
+/** primary: ( expr ) | unary-op arg | arg binary-op arg | arg**/
+bool testPrimary(struct testState *state)
+{
+    char **args = state->args;
+    int remaining = state->count - state->pos;
+    bool result;
+
+    if (remaining <= 0)
+    {
+        fprintf(stderr, "yash: test: argument expected\n");
+        state->error = true;
+        return false;
+    }
+    if (remaining >= 3 && isBinaryTest(args[state->pos + 1]))
+    {
+        result = testBinary(state, args[state->pos], args[state->pos + 1], args[state->pos + 2]);
+        state->pos += 3;
+        return result;
+    }
+    if (strcmp(args[state->pos], "(") == 0 && remaining >= 2)
+    {
+        state->pos++;
+        result = testOr(state);
+        if (state->pos >= state->count || strcmp(args[state->pos], ")") != 0)
+        {
+            fprintf(stderr, "yash: test: `)' expected\n");
+            state->error = true;
+            return false;
+        }
+        state->pos++;
+        return result;
+    }
+    if (remaining >= 2 && isUnaryTest(args[state->pos]))
+    {
+        result = testUnary(state, args[state->pos][1], args[state->pos + 1]);
+        state->pos += 2;
+        return result;
+    }
+    // a lone string is true when it is not empty
+    result = args[state->pos][0] != '\0';
+    state->pos++;
+    return result;
+}
+
+/** not: ! not | primary**/
+bool testNot(struct testState *state)
+{
+    if (state->pos < state->count - 1 && strcmp(state->args[state->pos], "!") == 0)
+    {
+        state->pos++;
+        return !testNot(state);
+    }
+    return testPrimary(state);
+}
+
+/** and: not { -a not }**/
+bool testAnd(struct testState *state)
+{
+    bool result = testNot(state);
+
+    while (state->pos < state->count && strcmp(state->args[state->pos], "-a") == 0)
+    {
+        state->pos++;
+        result = testNot(state) && result;
+    }
+    return result;
+}
+
+/** or: and { -o and }**/
+bool testOr(struct testState *state)
+{
+    bool result = testAnd(state);
+
+    while (state->pos < state->count && strcmp(state->args[state->pos], "-o") == 0)
+    {
+        state->pos++;
+        result = testAnd(state) || result;
+    }
+    return result;
+}
+
+/** The test and [ builtins: evaluates the expression with a recursive descent parser and returns 0 for true,
+ * 1 for false and 2 on a malformed expression**/
+int testCommand(char **args)
+{
+    struct testState state;
+    bool result;
+
+    state.args = args + 1;
+    state.count = 0;
+    state.pos = 0;
+    state.error = false;
+    while (state.args[state.count] != NULL)
+    {
+        state.count++;
+    }
+    if (strcmp(args[0], "[") == 0)
+    {
+        if (state.count == 0 || strcmp(state.args[state.count - 1], "]") != 0)
+        {
+            fprintf(stderr, "yash: [: missing `]'\n");
+            return 2;
+        }
+        state.count--;
+    }
+    if (state.count == 0)
+    {
+        return 1;
+    }
+
+    result = testOr(&state);
+    if (!state.error && state.pos < state.count)
+    {
+        fprintf(stderr, "yash: test: %s: unexpected argument\n", state.args[state.pos]);
+        state.error = true;
+    }
+    if (state.error)
+    {
+        return 2;
+    }
+    return result ? 0 : 1;
+}
+
+/** This function checks if the string is a valid variable name**/
+bool isValidName(const char *name, size_t length)
+{
+    size_t index;
+
+    if (length == 0 || !(isalpha((unsigned char)name[0]) || name[0] == '_'))
+    {
+        return false;
+    }
+    for (index = 1; index < length; index++)
+    {
+        if (!(isalnum((unsigned char)name[index]) || name[index] == '_'))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/** The export builtin: export name[=value] ... sets the variables and marks them for the environment of the
+ * commands run from now on; without arguments (or with -p) it lists the exported variables**/
+int exportCommand(char **args)
+{
+    int index = 1;
+    int status = 0;
+
+    if (args[1] != NULL && strcmp(args[1], "-p") == 0)
+    {
+        index++;
+    }
+    if (args[index] == NULL)
+    {
+        char **env;
+        for (env = exportedEnv; *env != NULL; env++)
+        {
+            printf("export %s\n", *env);
+        }
+        return 0;
+    }
+
+    for (; args[index] != NULL; index++)
+    {
+        char *equals = strchr(args[index], '=');
+        size_t nameLength = equals != NULL ? (size_t)(equals - args[index]) : strlen(args[index]);
+
+        if (!isValidName(args[index], nameLength))
+        {
+            fprintf(stderr, "yash: export: `%s': not a valid identifier\n", args[index]);
+            status = 1;
+            continue;
+        }
+        if (equals != NULL)
+        {
+            *equals = '\0';
+            setVariable(args[index], equals + 1, true);
+            *equals = '=';
+        }
+        else
+        {
+            // the value moves when the entry is rebuilt, so export a copy of it
+            char *value = strdup(getVariable(args[index]) != NULL ? getVariable(args[index]) : "");
+            setVariable(args[index], value, true);
+            free(value);
+        }
+    }
+    return status;
+}
+
+/** The unset builtin: removes the shell variables, and so takes them out of the environment**/
+int unsetCommand(char **args)
+{
+    int index = 1;
+    int status = 0;
+
+    if (args[1] != NULL && strcmp(args[1], "-v") == 0)
+    {
+        index++;
+    }
+    for (; args[index] != NULL; index++)
+    {
+        if (!isValidName(args[index], strlen(args[index])))
+        {
+            fprintf(stderr, "yash: unset: `%s': not a valid identifier\n", args[index]);
+            status = 1;
+            continue;
+        }
+        unsetVariable(args[index]);
+    }
+    return status;
+}
+
+/** The builtin table; it has to stay sorted by name for the binary search in findBuiltin**/
+struct builtin builtins[] = {
+    {"[", testCommand, true},
+    {"bg", backgroundJob, false},
+    {"break", breakCommand, false},
+    {"cd", changeDirectory, false},
+    {"continue", continueCommand, false},
+    {"echo", echoCommand, true},
+    {"exec", execCommand, false},
+    {"exit", exitCommand, false},
+    {"export", exportCommand, false},
+    {"false", falseCommand, true},
+    {"fg", foregroundJob, false},
+    {"hash", hashCommand, false},
+    {"jobctl", jobControlCommand, false},
+    {"jobs", listJobs, false},
+    {"kill", killCommand, false},
+    {"parallel", parallelCommand, false},
+    {"pwd", printWorkingDirectory, true},
+    {"set", setCommand, false},
+    {"test", testCommand, true},
+    {"timeout", timeoutCommand, false},
+    {"true", trueCommand, true},
+    {"unset", unsetCommand, false},
+    {"wait", waitCommand, false},
+    {"xargs", xargsCommand, false},
+};
+
+/** Comparison function for the builtin table**/
+int compareBuiltin(const void *name, const void *entry)
+{
+    return strcmp((const char *)name, ((const struct builtin *)entry)->name);
+}
+
+/** This function returns the builtin with exactly the given name or NULL**/
+struct builtin *findBuiltin(const char *name)
+{
+    return (struct builtin *)bsearch(name, builtins, sizeof(builtins) / sizeof(builtins[0]), sizeof(struct builtin),
+                                     compareBuiltin);
+}
+
+/** This function runs the builtin in the shell process. Redirections are applied to the shell's own stdin/stdout,
+ * which are saved first and put back once the builtin returns**/
+int runBuiltin(struct builtin *builtin, struct processList *process)
+{
+    int savedIn = -1;
+    int savedOut = -1;
+    int status;
+
+    fflush(stdout);
+    if (process->inputPath != NULL || process->inputText != NULL)
+    {
+        int fd = openInputRedirection(process);
+        if (fd < 0)
+        {
+            return 1;
+        }
+        savedIn = fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 10);
+        dup2(fd, STDIN_FILENO);
+        close(fd);
+    }
+    if (process->outputPath != NULL)
+    {
+        int fd = open(process->outputPath, O_CREAT | O_WRONLY | (process->appendOutput ? O_APPEND : O_TRUNC) | O_CLOEXEC,
+                      S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+        if (fd < 0)
+        {
+            fprintf(stderr, "yash: %s: %s\n", process->outputPath, strerror(errno));
+            if (savedIn >= 0)
+            {
+                dup2(savedIn, STDIN_FILENO);
+                close(savedIn);
+            }
+            return 1;
+        }
+        savedOut = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 10);
+        dup2(fd, STDOUT_FILENO);
+        close(fd);
+    }
+
+    status = builtin->handler(process->processArgs);
+    fflush(stdout);
+
+    if (builtin->handler == execCommand)
+    {
+        // exec without a command: the redirections are meant for the shell from now on
+        if (savedIn >= 0)
+        {
+            close(savedIn);
+        }
+        if (savedOut >= 0)
+        {
+            close(savedOut);
+        }
+        return status;
+    }
+    if (savedIn >= 0)
+    {
+        dup2(savedIn, STDIN_FILENO);
+        close(savedIn);
+    }
+    if (savedOut >= 0)
+    {
+        dup2(savedOut, STDOUT_FILENO);
+        close(savedOut);
+    }
+    return status;
+}
+
+/** This function appends text to the buffer, growing it as needed. The buffer is always NUL-terminated**/
+void appendText(struct textBuffer *buffer, const char *text, size_t length)
+{
+    if (buffer->length + length + 1 > buffer->capacity)
+    {
+        buffer->capacity = buffer->capacity == 0 ? TEXT_BUFFER_MIN_SIZE : buffer->capacity;
+        while (buffer->length + length + 1 > buffer->capacity)
+        {
+            buffer->capacity *= 2;
+        }
+        buffer->data = (char *)realloc(buffer->data, buffer->capacity);
+    }
+    memcpy(buffer->data + buffer->length, text, length);
+    buffer->length += length;
+    buffer->data[buffer->length] = '\0';
+}
+
+/** This function appends text to the field being built. Next to the field it keeps the pattern the field is matched
+ * as: characters that were quoted, and every backslash, are escaped in it, and an unquoted *, ? or [ marks the field
+ * for pathname expansion**/
+void appendField(struct fieldList *fields, const char *text, size_t length, bool quoted)
+{
+    size_t start = 0;
+    size_t index;
+
+    appendText(&fields->field, text, length);
+    for (index = 0; index < length; index++)
+    {
+        if (text[index] != '*' && text[index] != '?' && text[index] != '[' && text[index] != '\\')
+        {
+            continue;
+        }
+        if (quoted || text[index] == '\\')
+        {
+            appendText(&fields->pattern, text + start, index - start);
+            appendText(&fields->pattern, "\\", 1);
+            start = index;
+        }
+        else
+        {
+            fields->glob = true;
+        }
+    }
+    appendText(&fields->pattern, text + start, length - start);
+}
+
+/** This function adds a word to the list of fields**/
+void addField(struct fieldList *fields, char *word)
+{
+    if (fields->count + 1 >= fields->capacity)
+    {
+        fields->capacity = fields->capacity == 0 ? 8 : fields->capacity * 2;
+        fields->words = (char **)realloc(fields->words, sizeof(char *) * fields->capacity);
+    }
+    fields->words[fields->count++] = word;
+}
+
+/** This function ends the field being built and adds it to the list of fields, copied into the line arena. A field
+ * with an unquoted pattern is replaced by the sorted paths it matches; one that matches nothing stays as it is**/
+void endField(struct fieldList *fields)
+{
+    if (!fields->glob || !hasGlobChar(fields->pattern.data, fields->pattern.length) ||
+        expandPattern(fields->pattern.data, fields) == 0)
+    {
+        addField(fields, arenaStrdup(&lineArena, fields->field.length > 0 ? fields->field.data : ""));
+    }
+    fields->field.length = 0;
+    fields->pattern.length = 0;
+    fields->glob = false;
+    fields->started = false;
+}
+
+/** This function checks if the text holds a *, ?, or [ with a ] behind it that is not escaped by a backslash**/
+bool hasGlobChar(const char *text, size_t length)
+{
+    size_t index;
+
+    for (index = 0; index < length; index++)
+    {
+        if (text[index] == '\\')
+        {
+            index++;
+        }
+        else if (text[index] == '*' || text[index] == '?')
+        {
+            return true;
+        }
+        else if (text[index] == '[' && memchr(text + index + 1, ']', length - index - 1) != NULL)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/** This function returns the ] that closes the bracket expression starting at pattern, or NULL if there is none
+ * and the [ is an ordinary character. A ] right behind the [ or its ! or ^ is part of the set**/
+const char *findBracketEnd(const char *pattern)
+{
+    pattern++;
+    if (*pattern == '!' || *pattern == '^')
+    {
+        pattern++;
+    }
+    if (*pattern == ']')
+    {
+        pattern++;
+    }
+    for (; *pattern != '\0' && *pattern != ']'; pattern++)
+    {
+        if (*pattern == '\\' && pattern[1] != '\0')
+        {
+            pattern++;
+        }
+    }
+    return *pattern == ']' ? pattern : NULL;
+}
+
+/** This function checks if c is in the set of the bracket expression between start (behind the [) and end (the ])**/
+bool matchBracket(const char *start, const char *end, char c)
+{
+    bool negate = *start == '!' || *start == '^';
+    bool matched = false;
+
+    for (start += negate; start < end && !matched; start++)
+    {
+        unsigned char low;
+        unsigned char high;
+
+        if (*start == '\\' && start + 1 < end)
+        {
+            start++;
+        }
+        low = high = (unsigned char)*start;
+        if (start + 2 < end && start[1] == '-')
+        {
+            start += 2;
+            if (*start == '\\' && start + 1 < end)
+            {
+                start++;
+            }
+            high = (unsigned char)*start;
+        }
+        matched = (unsigned char)c >= low && (unsigned char)c <= high;
+    }
+    return matched != negate;
+}
+
+/** This function matches one element of the pattern (?, a bracket expression or a possibly escaped character)
+ * against c and moves the pattern behind it**/
+bool matchChar(const char **pattern, char c)
+{
+    const char *p = *pattern;
+    const char *end;
+
+    if (*p == '?')
+    {
+        *pattern = p + 1;
+        return true;
+    }
+    if (*p == '[' && (end = findBracketEnd(p)) != NULL)
+    {
+        *pattern = end + 1;
+        return matchBracket(p + 1, end, c);
+    }
+    if (*p == '\\' && p[1] != '\0')
+    {
+        p++;
+    }
+    *pattern = p + 1;
+    return *p == c;
+}
+
+/** This function matches a name against a pattern of one path component. A * backtracks to the last star only, which
+ * keeps the match linear in practice and needs no allocation**/
+bool matchPattern(const char *pattern, const char *name)
+{
+    const char *starPattern = NULL;
+    const char *starName = NULL;
+
+    while (*name != '\0')
+    {
+        if (*pattern == '*')
+        {
+            starPattern = ++pattern;
+            starName = name;
+            continue;
+        }
+        if (*pattern != '\0' && matchChar(&pattern, *name))
+        {
+            name++;
+            continue;
+        }
+        if (starPattern == NULL)
+        {
+            return false;
+        }
+        pattern = starPattern;
+        name = ++starName;
+    }
+    while (*pattern == '*')
+    {
+        pattern++;
+    }
+    return *pattern == '\0';
+}
+
+/** This function returns the entries of the directory, without . and .., or NULL if it cannot be read. Directories
+ * are read with getdents64 in large batches and kept until the end of the command line, so a line that expands
+ * several patterns in one directory reads it once; a cached listing is only used while the mtime of the directory is
+ * the same. A directory changed in the same clock tick as it was read could change again without a new mtime, so
+ * such a listing is read again every time**/
+struct directoryListing *readDirectory(const char *path)
+{
+    unsigned int hash = hashString(path);
+    struct directoryListing *listing;
+    struct stat info;
+    long count;
+    int fd;
+
+    for (listing = directoryCache[hash % DIRECTORY_CACHE_BUCKETS]; listing != NULL; listing = listing->next)
+    {
+        if (listing->hash == hash && strcmp(listing->path, path) == 0)
+        {
+            break;
+        }
+    }
+    if (listing != NULL && stat(path, &info) == 0 && info.st_mtim.tv_sec == listing->mtime.tv_sec &&
+        info.st_mtim.tv_nsec == listing->mtime.tv_nsec &&
+        (listing->mtime.tv_sec < listing->scanned.tv_sec ||
+         (listing->mtime.tv_sec == listing->scanned.tv_sec && listing->mtime.tv_nsec < listing->scanned.tv_nsec)))
+    {
+        return listing;
+    }
+
+    if ((fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0)
+    {
+        if (listing != NULL)
+        {
+            listing->count = 0;
+            listing->size = 0;
+        }
+        return NULL;
+    }
+    if (listing == NULL)
+    {
+        listing = (struct directoryListing *)malloc(sizeof(struct directoryListing));
+        listing->path = strdup(path);
+        listing->hash = hash;
+        listing->names = NULL;
+        listing->capacity = 0;
+        listing->next = directoryCache[hash % DIRECTORY_CACHE_BUCKETS];
+        directoryCache[hash % DIRECTORY_CACHE_BUCKETS] = listing;
+    }
+    // the times are taken before the directory is read, a change while it is read gives it a newer mtime
+    clock_gettime(CLOCK_REALTIME_COARSE, &listing->scanned);
+    fstat(fd, &info);
+    listing->mtime = info.st_mtim;
+    listing->size = 0;
+    listing->count = 0;
+    if (direntBuffer == NULL)
+    {
+        direntBuffer = (char *)malloc(DIRENT_BUFFER_SIZE);
+    }
+
+    while ((count = syscall(SYS_getdents64, fd, direntBuffer, DIRENT_BUFFER_SIZE)) > 0)
+    {
+        long offset;
+
+        for (offset = 0; offset < count;)
+        {
+            struct linuxDirent64 *entry = (struct linuxDirent64 *)(direntBuffer + offset);
+            const char *name = entry->d_name;
+            size_t nameLength;
+
+            offset += entry->d_reclen;
+            if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+            {
+                continue;
+            }
+            nameLength = strlen(name);
+            if (listing->size + nameLength + 2 > listing->capacity)
+            {
+                listing->capacity = listing->capacity == 0 ? TEXT_BUFFER_MIN_SIZE : listing->capacity;
+                while (listing->size + nameLength + 2 > listing->capacity)
+                {
+                    listing->capacity *= 2;
+                }
+                listing->names = (char *)realloc(listing->names, listing->capacity);
+            }
+            listing->names[listing->size++] = (char)entry->d_type;
+            memcpy(listing->names + listing->size, name, nameLength + 1);
+            listing->size += nameLength + 1;
+            listing->count++;
+        }
+    }
+    close(fd);
+    return listing;
+}
+
+/** This function forgets the directories read for the command line**/
+void clearDirectoryCache()
+{
+    int index;
+
+    for (index = 0; index < DIRECTORY_CACHE_BUCKETS; index++)
+    {
+        while (directoryCache[index] != NULL)
+        {
+            struct directoryListing *listing = directoryCache[index];
+
+            directoryCache[index] = listing->next;
+            free(listing->names);
+            free(listing->path);
+            free(listing);
+        }
+    }
+}
+
+/** This function checks if the entry name of the directory in path is a directory. The type from getdents64 answers
+ * it without a system call unless it is unknown, or a symbolic link that is to be followed**/
+bool isDirectoryEntry(struct textBuffer *path, const char *name, unsigned char type, bool follow)
+{
+    size_t base = path->length;
+    struct stat info;
+    bool directory;
+
+    if (type == DT_DIR || (type != DT_UNKNOWN && (type != DT_LNK || !follow)))
+    {
+        return type == DT_DIR;
+    }
+    appendText(path, name, strlen(name));
+    directory = (follow ? stat(path->data, &info) : lstat(path->data, &info)) == 0 && S_ISDIR(info.st_mode);
+    path->length = base;
+    path->data[base] = '\0';
+    return directory;
+}
+
+/** This function expands the components index to count of a pattern in the directory path, which is empty for the
+ * current directory or ends with a slash, and adds the paths that match. A component without pattern characters is
+ * used as it is, ** matches any number of directories (without following symbolic links), and only a pattern that
+ * starts with a dot matches names that do**/
+void globPath(struct textBuffer *path, char **components, int index, int count, struct fieldList *fields)
+{
+    const char *component = components[index];
+    size_t base = path->length;
+    bool last = index == count - 1;
+    bool recursive = strcmp(component, "**") == 0;
+    bool dotted = component[0] == '.' || (component[0] == '\\' && component[1] == '.');
+    struct directoryListing *listing;
+    const char *entry;
+    int entryIndex;
+
+    if (!hasGlobChar(component, strlen(component)))
+    {
+        struct stat info;
+
+        for (; *component != '\0'; component++)
+        {
+            if (*component == '\\' && component[1] != '\0')
+            {
+                component++;
+            }
+            appendText(path, component, 1);
+        }
+        if (!last)
+        {
+            appendText(path, "/", 1);
+            globPath(path, components, index + 1, count, fields);
+        }
+        else if (path->length > 0 && lstat(path->data, &info) == 0)
+        {
+            addField(fields, arenaStrdup(&lineArena, path->data));
+        }
+        path->length = base;
+        path->data[base] = '\0';
+        return;
+    }
+    if (recursive && !last)
+    {
+        globPath(path, components, index + 1, count, fields);
+    }
+
+    if ((listing = readDirectory(base == 0 ? "." : path->data)) == NULL)
+    {
+        return;
+    }
+    for (entry = listing->names, entryIndex = 0; entryIndex < listing->count; entryIndex++)
+    {
+        unsigned char type = (unsigned char)entry[0];
+        const char *name = entry + 1;
+        size_t nameLength = strlen(name);
+
+        entry = name + nameLength + 1;
+        if ((name[0] == '.' && !dotted) || (!recursive && !matchPattern(component, name)))
+        {
+            continue;
+        }
+        if (recursive || !last)
+        {
+            if (!isDirectoryEntry(path, name, type, !recursive))
+            {
+                if (recursive && last)
+                {
+                    appendText(path, name, nameLength);
+                    addField(fields, arenaStrdup(&lineArena, path->data));
+                    path->length = base;
+                    path->data[base] = '\0';
+                }
+                continue;
+            }
+        }
+        appendText(path, name, nameLength);
+        if (recursive && last)
+        {
+            addField(fields, arenaStrdup(&lineArena, path->data));
+        }
+        if (recursive || !last)
+        {
+            appendText(path, "/", 1);
+            globPath(path, components, recursive ? index : index + 1, count, fields);
+        }
+        else
+        {
+            addField(fields, arenaStrdup(&lineArena, path->data));
+        }
+        path->length = base;
+        path->data[base] = '\0';
+    }
+}
+
+/** qsort comparison of two strings**/
+int compareFields(const void *a, const void *b)
+{
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/** This function adds the sorted paths that match the pattern to the list of fields and returns how many there are**/
+int expandPattern(const char *pattern, struct fieldList *fields)
+{
+    struct textBuffer path = {NULL, 0, 0};
+    char *copy = strdup(pattern);
+    char **components;
+    char *slash;
+    int count = 1;
+    int start = fields->count;
+
+    for (slash = copy; (slash = strchr(slash, '/')) != NULL; slash++)
+    {
+        count++;
+    }
+    components = (char **)malloc(sizeof(char *) * count);
+    components[0] = copy;
+    for (count = 1, slash = copy; (slash = strchr(slash, '/')) != NULL;)
+    {
+        *slash++ = '\0';
+        components[count++] = slash;
+    }
+
+    appendText(&path, "", 0);
+    globPath(&path, components, 0, count, fields);
+    qsort(fields->words + start, fields->count - start, sizeof(char *), compareFields);
+    free(path.data);
+    free(components);
+    free(copy);
+    return fields->count - start;
+}
+
+/** This function adds the output of a command substitution to the field being built. Unquoted output is split into
+ * fields at blanks and newlines, quoted output goes in as it is**/
+void appendSubstitution(struct fieldList *fields, const char *text, size_t length, bool split)
+{
+    size_t index;
+    size_t start = 0;
+
+    if (!split)
+    {
+        appendField(fields, text, length, true);
+        fields->started = true;
+        return;
+    }
+    for (index = 0; index <= length; index++)
+    {
+        if (index < length && text[index] != ' ' && text[index] != '\t' && text[index] != '\n')
+        {
+            continue;
+        }
+        if (index > start)
+        {
+            appendField(fields, text + start, index - start, false);
+            fields->started = true;
+        }
+        if (index < length && fields->started)
+        {
+            endField(fields);
+        }
+        start = index + 1;
+    }
+}
+
+/** This function runs the command of a $(...) or `...` substitution and returns what it wrote to stdout, without
+ * trailing newlines, in a malloc'd buffer. A single builtin that does not touch the state of the shell (echo, pwd,
+ * test, ...) runs in the shell with stdout going to a memory stream, so it costs no fork; anything else runs in a
+ * forked copy of the shell whose output is read from a pipe. The exit status of the command becomes the status**/
+char *commandSubstitution(const char *command, size_t *length)
+{
+    struct textBuffer output = {NULL, 0, 0};
+    struct astNode *ast;
+    struct astNode *single;
+    struct stage *stage;
+    struct builtin *builtin = NULL;
+    char **args = NULL;
+    int result;
+    int pipefd[2];
+    pid_t pid;
+
+    appendText(&output, "", 0);
+    *length = 0;
+    ranSubstitution = true;
+    if ((ast = parseSource(command, true, &result)) == NULL)
+    {
+        lastExitStatus = result;
+        return output.data;
+    }
+
+    for (single = ast; single->type == NODE_SEQUENCE && single->right == NULL; single = single->left)
+    {
+    }
+    stage = single->type == NODE_PIPELINE && !single->timed ? single->stages : NULL;
+    if (stage != NULL && stage->next == NULL && stage->compound == NULL && stage->inputPath == NULL &&
+        stage->inputText == NULL && stage->hereString == NULL && stage->outputPath == NULL)
+    {
+        // the builtin is looked up by its literal name, so that the words are expanded only once: here when the
+        // builtin runs in the shell, in the child otherwise
+        if (stage->args[0] != NULL && (!stage->expand || strpbrk(stage->args[0], "$`\\\"'*?[~") == NULL))
+        {
+            builtin = findBuiltin(stage->args[0]);
+        }
+    }
+    if (builtin != NULL && builtin->pure)
+    {
+        args = stage->expand ? expandWords(stage->args, NULL) : stage->args;
+        FILE *shellStdout = stdout;
+        char *data = NULL;
+        size_t size = 0;
+        FILE *capture;
+
+        fflush(stdout);
+        if ((capture = open_memstream(&data, &size)) != NULL)
+        {
+            stdout = capture;
+            lastExitStatus = builtin->handler(args);
+            fclose(capture);
+            stdout = shellStdout;
+            free(output.data);
+            output.data = data;
+            output.length = size;
+            return trimSubstitution(&output, length);
+        }
+    }
+
+    if (pipe2(pipefd, O_CLOEXEC) < 0)
+    {
+        perror("yash: pipe");
+        lastExitStatus = 1;
+        return output.data;
+    }
+    fflush(stdout);
+    if ((pid = fork()) < 0)
+    {
+        perror("yash: fork");
+        close(pipefd[0]);
+        close(pipefd[1]);
+        lastExitStatus = 1;
+        return output.data;
+    }
+    if (pid == 0)
+    {
+        // the substitution runs in a copy of the shell that stays in the foreground group of the shell
+        interactive = false;
+        prepareChild(0);
+        dup2(pipefd[1], STDOUT_FILENO);
+        tailPosition = true;
+        result = executeNode(ast);
+        fflush(stdout);
+        if (traceEnabled)
+        {
+            flushTrace();
+        }
+        _exit(result);
+    }
+    close(pipefd[1]);
+    while (1)
+    {
+        char chunk[SUBSTITUTION_READ_SIZE];
+        ssize_t count = read(pipefd[0], chunk, sizeof(chunk));
+
+        if (count < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (count <= 0)
+        {
+            break;
+        }
+        appendText(&output, chunk, count);
+    }
+    close(pipefd[0]);
+    while (waitpid(pid, &result, 0) < 0 && errno == EINTR)
+    {
+    }
+    lastExitStatus = WIFEXITED(result) ? WEXITSTATUS(result) : 128 + WTERMSIG(result);
+    return trimSubstitution(&output, length);
+}
+
+/** This function drops the trailing newlines of the captured output and returns it, with its length in length**/
+char *trimSubstitution(struct textBuffer *output, size_t *length)
+{
+    while (output->length > 0 && output->data[output->length - 1] == '\n')
+    {
+        output->length--;
+    }
+    output->data[output->length] = '\0';
+    *length = output->length;
+    return output->data;
+}
+
+/** This function returns the index behind the expansion that starts at text[index]: $(...), `...`, ${...} or the
+ * $ of $name, $? or $$ (the name itself is scanned as an ordinary word). It returns -1 if the expansion is not
+ * closed. expand is set if there is something to expand; a $ that starts nothing is an ordinary character**/
+size_t skipExpansion(const char *text, size_t index, size_t length, bool *expand)
+{
+    char next = index + 1 < length ? text[index + 1] : '\0';
+
+    if (text[index] == '`')
+    {
+        *expand = true;
+        return skipBackquote(text, index, length);
+    }
+    if (next == '(')
+    {
+        *expand = true;
+        return skipSubstitution(text, index, length);
+    }
+    if (next == '{')
+    {
+        const char *close = (const char *)memchr(text + index + 2, '}', length - index - 2);
+        *expand = true;
+        return close != NULL ? (size_t)(close - text + 1) : (size_t)-1;
+    }
+    if (isalpha((unsigned char)next) || next == '_' || next == '?' || next == '$')
+    {
+        *expand = true;
+        return index + 2;
+    }
+    return index + 1;
+}
+
+/** This function returns the character that closes the expansion starting at text[index], for error messages**/
+char getClosingChar(const char *text, size_t index)
+{
+    if (text[index] == '`')
+    {
+        return '`';
+    }
+    return text[index + 1] == '{' ? '}' : ')';
+}
+
+/** This function returns the index behind the $(...) substitution that starts at index, or -1 if its closing
+ * parenthesis is missing. Quotes, nested substitutions and backquotes inside are skipped as a whole**/
+size_t skipSubstitution(const char *text, size_t index, size_t length)
+{
+    int depth = 1;
+
+    for (index += 2; index < length; index++)
+    {
+        switch (text[index])
+        {
+        case '\'':
+        {
+            const char *close = memchr(text + index + 1, '\'', length - index - 1);
+            if (close == NULL)
+            {
+                return (size_t)-1;
+            }
+            index = close - text;
+            break;
+        }
+        case '"':
+            for (index++; index < length && text[index] != '"'; index++)
+            {
+                if (text[index] == '\\')
+                {
+                    index++;
+                }
+                else if (text[index] == '$' && index + 1 < length && text[index + 1] == '(')
+                {
+                    if ((index = skipSubstitution(text, index, length)) == (size_t)-1)
+                    {
+                        return index;
+                    }
+                    index--;
+                }
+            }
+            if (index >= length)
+            {
+                return (size_t)-1;
+            }
+            break;
+        case '\\':
+            index++;
+            break;
+        case '`':
+            if ((index = skipBackquote(text, index, length)) == (size_t)-1)
+            {
+                return index;
+            }
+            index--;
+            break;
+        case '$':
+            if (index + 1 < length && text[index + 1] == '(')
+            {
+                if ((index = skipSubstitution(text, index, length)) == (size_t)-1)
+                {
+                    return index;
+                }
+                index--;
+            }
+            break;
+        case '(':
+            depth++;
+            break;
+        case ')':
+            if (--depth == 0)
+            {
+                return index + 1;
+            }
+            break;
+        }
+    }
+    return (size_t)-1;
+}
+
+/** This function returns the index behind the `...` substitution that starts at index, or -1 if the closing
+ * backquote is missing**/
+size_t skipBackquote(const char *text, size_t index, size_t length)
+{
+    for (index++; index < length && text[index] != '`'; index++)
+    {
+        if (text[index] == '\\')
+        {
+            index++;
+        }
+    }
+    return index < length ? index + 1 : (size_t)-1;
+}
+
+/** This function runs the substitution that starts at text[index] ($( or `) and adds its output to the field being
+ * built. Inside backquotes a backslash only escapes $, ` and another backslash. Returns the index behind it**/
+size_t expandSubstitution(const char *text, size_t index, size_t length, struct fieldList *fields, bool split)
+{
+    size_t end;
+    size_t outputLength;
+    char *command;
+    char *output;
+
+    if (text[index] == '$')
+    {
+        end = skipSubstitution(text, index, length);
+        command = strndup(text + index + 2, end - index - 3);
+    }
+    else
+    {
+        size_t read;
+        size_t write = 0;
+
+        end = skipBackquote(text, index, length);
+        command = (char *)malloc(end - index);
+        for (read = index + 1; read < end - 1; read++)
+        {
+            if (text[read] == '\\' && (text[read + 1] == '$' || text[read + 1] == '`' || text[read + 1] == '\\'))
+            {
+                read++;
+            }
+            command[write++] = text[read];
+        }
+        command[write] = '\0';
+    }
+    output = commandSubstitution(command, &outputLength);
+    appendSubstitution(fields, output, outputLength, split);
+    free(output);
+    free(command);
+    return end;
+}
+
+/** This function expands the $name, ${name}, $? or $$ at text[index] into the field being built; the value is split
+ * into fields like the output of a substitution unless split is false. A $ that starts none of these stays as it
+ * is. Returns the index behind the expansion**/
+size_t expandParameter(const char *text, size_t index, size_t length, struct fieldList *fields, bool split)
+{
+    const char *name = text + index + 1;
+    size_t nameLength = 0;
+    size_t end;
+    const char *value = NULL;
+    char number[16];
+
+    if (index + 1 < length && text[index + 1] == '{')
+    {
+        name++;
+        end = (const char *)memchr(name, '}', length - index - 2) - text + 1;
+        nameLength = end - index - 3;
+    }
+    else
+    {
+        if (index + 1 < length && (text[index + 1] == '?' || text[index + 1] == '$'))
+        {
+            nameLength = 1;
+        }
+        else
+        {
+            while (index + 1 + nameLength < length && (isalnum((unsigned char)name[nameLength]) || name[nameLength] == '_'))
+            {
+                nameLength++;
+            }
+        }
+        if (nameLength == 0)
+        {
+            appendField(fields, "$", 1, !split);
+            fields->started = true;
+            return index + 1;
+        }
+        end = index + 1 + nameLength;
+    }
+
+    if (nameLength == 1 && *name == '?')
+    {
+        snprintf(number, sizeof(number), "%d", lastExitStatus);
+        value = number;
+    }
+    else if (nameLength == 1 && *name == '$')
+    {
+        snprintf(number, sizeof(number), "%d", (int)shellPid);
+        value = number;
+    }
+    else if (isValidName(name, nameLength))
+    {
+        struct variable *var = findVariable(name, nameLength);
+        value = var != NULL ? var->entry + var->nameLength + 1 : NULL;
+    }
+    else
+    {
+        fprintf(stderr, "yash: %.*s: bad substitution\n", (int)(end - index), text + index);
+    }
+    if (value != NULL)
+    {
+        appendSubstitution(fields, value, strlen(value), split);
+    }
+    return end;
+}
+
+/** This function expands the $ or ` expansion at text[index] into the field being built. Returns the index behind
+ * it**/
+size_t expandDollar(const char *text, size_t index, size_t length, struct fieldList *fields, bool split)
+{
+    bool expand = false;
+
+    if (skipExpansion(text, index, length, &expand) == (size_t)-1)
+    {
+        // only a here-document can hold an expansion that is not closed, it stays as it is
+        appendField(fields, text + index, 1, !split);
+        fields->started = true;
+        return index + 1;
+    }
+    if (text[index] == '`' || (index + 1 < length && text[index + 1] == '('))
+    {
+        return expandSubstitution(text, index, length, fields, split);
+    }
+    return expandParameter(text, index, length, fields, split);
+}
+
+/** This function expands a word kept with its quotes by the parser: quotes and backslashes are removed, variables
+ * and command substitutions are replaced by their values, which are split into fields unless they are quoted or
+ * split is false.
+ * The fields are added to the list; a word that expands to nothing unquoted adds none**/
+void expandWord(const char *word, struct fieldList *fields, bool split)
+{
+    size_t length = strlen(word);
+    size_t index = 0;
+
+    while (index < length)
+    {
+        char c = word[index];
+
+        if (c == '\'')
+        {
+            const char *close = strchr(word + index + 1, '\'');
+            appendField(fields, word + index + 1, close - word - index - 1, true);
+            fields->started = true;
+            index = close - word + 1;
+        }
+        else if (c == '"')
+        {
+            fields->started = true;
+            for (index++; word[index] != '"';)
+            {
+                if (word[index] == '\\' && word[index + 1] != '\0' && strchr("\\\"$`\n", word[index + 1]) != NULL)
+                {
+                    if (word[index + 1] != '\n')
+                    {
+                        appendField(fields, word + index + 1, 1, true);
+                    }
+                    index += 2;
+                }
+                else if (word[index] == '$' || word[index] == '`')
+                {
+                    index = expandDollar(word, index, length, fields, false);
+                }
+                else
+                {
+                    appendField(fields, word + index++, 1, true);
+                }
+            }
+            index++;
+        }
+        else if (c == '\\')
+        {
+            if (word[index + 1] != '\n' && word[index + 1] != '\0')
+            {
+                appendField(fields, word + index + 1, 1, true);
+                fields->started = true;
+            }
+            index += word[index + 1] != '\0' ? 2 : 1;
+        }
+        else if (c == '$' || c == '`')
+        {
+            index = expandDollar(word, index, length, fields, split);
+        }
+        else
+        {
+            appendField(fields, word + index++, 1, !split);
+            fields->started = true;
+        }
+    }
+    if (fields->started || !split)
+    {
+        endField(fields);
+    }
+}
+
+/** This function expands the body of a here-document with an unquoted delimiter: variables and substitutions are
+ * replaced, a backslash only escapes $, `, another backslash or a newline, and quotes are ordinary characters**/
+char *expandHereDocument(const char *text)
+{
+    struct fieldList fields;
+    size_t length = strlen(text);
+    size_t index = 0;
+    char *result;
+
+    memset(&fields, 0, sizeof(struct fieldList));
+    while (index < length)
+    {
+        size_t plain = strcspn(text + index, "\\$`");
+
+        appendText(&fields.field, text + index, plain);
+        index += plain;
+        if (index >= length)
+        {
+            break;
+        }
+        if (text[index] == '\\')
+        {
+            if (index + 1 < length && strchr("$`\\\n", text[index + 1]) != NULL)
+            {
+                if (text[index + 1] != '\n')
+                {
+                    appendText(&fields.field, text + index + 1, 1);
+                }
+                index += 2;
+            }
+            else
+            {
+                appendText(&fields.field, text + index++, 1);
+            }
+        }
+        else
+        {
+            index = expandDollar(text, index, length, &fields, false);
+        }
+    }
+    endField(&fields);
+    result = fields.words[0];
+    free(fields.words);
+    free(fields.field.data);
+    free(fields.pattern.data);
+    return result;
+}
+
+/** This function expands the NULL-terminated word list into a new NULL-terminated list in the line arena. The
+ * number of resulting words is stored in count unless it is NULL**/
+char **expandWords(char **words, int *count)
+{
+    struct fieldList fields;
+    char **result;
+
+    memset(&fields, 0, sizeof(struct fieldList));
+    for (; *words != NULL; words++)
+    {
+        expandWord(*words, &fields, true);
+    }
+    result = (char **)arenaAlloc(&lineArena, sizeof(char *) * (fields.count + 1));
+    if (fields.count > 0)
+    {
+        memcpy(result, fields.words, sizeof(char *) * fields.count);
+    }
+    result[fields.count] = NULL;
+    if (count != NULL)
+    {
+        *count = fields.count;
+    }
+    free(fields.words);
+    free(fields.field.data);
+    free(fields.pattern.data);
+    return result;
+}
+
+/** This function expands a word that must stay one word, such as the file of a redirection, into the line arena**/
+char *expandSingleWord(const char *word)
+{
+    struct fieldList fields;
+    char *result;
+
+    memset(&fields, 0, sizeof(struct fieldList));
+    expandWord(word, &fields, false);
+    result = fields.words[0];
+    free(fields.words);
+    free(fields.field.data);
+    free(fields.pattern.data);
+    return result;
+}
+
+/** This function checks if the rest of the current list has to be skipped: after break or continue, or after a
+ * foreground command was interrupted with ^C**/
+bool listAborted()
+{
+    return breakLevels > 0 || continueLevels > 0 || interrupted;
+}
+
+/** This function is called by a loop after its body (or condition) ran and tells whether the loop has to stop
+ * because of break, continue for an outer loop or an interrupt**/
+bool endLoop()
+{
+    if (interrupted)
+    {
+        return true;
+    }
+    if (breakLevels > 0)
+    {
+        breakLevels--;
+        return true;
+    }
+    if (continueLevels > 0)
+    {
+        continueLevels--;
+        return continueLevels > 0;
+    }
+    return false;
+}
+
+/** This function sets the shell variables of the NAME=value assignments**/
+void assignVariables(char **assignments)
+{
+    for (; *assignments != NULL; assignments++)
+    {
+        char *equals = strchr(*assignments, '=');
+
+        *equals = '\0';
+        setVariable(*assignments, equals + 1, false);
+        *equals = '=';
+    }
+}
+
+/** This function fills in the words, assignments and redirections of the stage for running it, expanding them
+ * first if the stage has expansions. A here-string becomes its text with a newline, and a command with assignments
+ * in front of it gets its own environment**/
+void expandStage(struct stage *stage, struct processList *process)
+{
+    static char *emptyCommand[] = {"true", NULL};
+    char *hereString = stage->hereString;
+
+    process->processArgs = stage->args;
+    process->inputPath = stage->inputPath;
+    process->inputText = stage->expandInput ? expandHereDocument(stage->inputText) : stage->inputText;
+    process->outputPath = stage->outputPath;
+    process->assignments = stage->assignments;
+    if (stage->expand)
+    {
+        if (stage->assignments != NULL)
+        {
+            int count;
+
+            for (count = 0; stage->assignments[count] != NULL; count++)
+            {
+            }
+            process->assignments = (char **)arenaAlloc(&lineArena, sizeof(char *) * (count + 1));
+            for (count = 0; stage->assignments[count] != NULL; count++)
+            {
+                process->assignments[count] = expandSingleWord(stage->assignments[count]);
+            }
+            process->assignments[count] = NULL;
+        }
+        process->processArgs = expandWords(stage->args, NULL);
+        process->inputPath = stage->inputPath != NULL ? expandSingleWord(stage->inputPath) : NULL;
+        process->outputPath = stage->outputPath != NULL ? expandSingleWord(stage->outputPath) : NULL;
+        hereString = hereString != NULL ? expandSingleWord(hereString) : NULL;
+    }
+    if (stage->compound == NULL && process->processArgs[0] == NULL && stage->next != NULL)
+    {
+        // an empty stage still has to be there to close its end of the pipe
+        process->processArgs = emptyCommand;
+    }
+    if (process->assignments != NULL && process->processArgs[0] != NULL)
+    {
+        process->environment = commandEnvironment(process->assignments);
+    }
+    if (hereString != NULL)
+    {
+        size_t length = strlen(hereString);
+
+        process->inputText = (char *)arenaAlloc(&lineArena, length + 2);
+        memcpy(process->inputText, hereString, length);
+        process->inputText[length] = '\n';
+        process->inputText[length + 1] = '\0';
+    }
+}
+
+/** This function runs the pipeline node. A single builtin in the foreground runs in the shell, so does a single
+ * compound command without redirections; everything else is started as a job, with compound stages run by a
+ * forked copy of the shell. The processList is built in the line arena and released again afterwards, so a loop
+ * running the pipeline many times does not grow the arena. A timed pipeline reports the elapsed time and the
+ * resource usage of all its stages once it is done. Returns the exit status**/
+int runPipelineNode(struct astNode *node, int job_type)
+{
+    struct arenaMark mark = arenaSave(&lineArena);
+    struct processList *pipeline = NULL;
+    struct processList **link = &pipeline;
+    struct stage *stage = node->stages;
+    struct timespec startTime;
+    struct rusage shellStart;
+    struct rusage childrenStart;
+    bool tail = tailPosition && !node->timed;
+
+    tailPosition = false;
+    if (node->timed)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &startTime);
+        getrusage(RUSAGE_SELF, &shellStart);
+        getrusage(RUSAGE_CHILDREN, &childrenStart);
+    }
+
+    if (stage == NULL)
+    {
+        lastExitStatus = 0;
+    }
+    else if (job_type == fg && stage->next == NULL && stage->compound != NULL && stage->inputPath == NULL &&
+             stage->inputText == NULL && stage->hereString == NULL && stage->outputPath == NULL)
+    {
+        tailPosition = tail;
+        executeNode(stage->compound);
+    }
+    else
+    {
+        struct builtin *builtin;
+
+        ranSubstitution = false;
+        for (; stage != NULL; stage = stage->next)
+        {
+            struct processList *process = (struct processList *)arenaAlloc(&lineArena, sizeof(struct processList));
+
+            memset(process, 0, sizeof(struct processList));
+            expandStage(stage, process);
+            process->appendOutput = stage->appendOutput;
+            process->compound = stage->compound;
+            *link = process;
+            link = &process->next;
+        }
+        pipeline->processString = node->text;
+        rootProcess = pipeline;
+
+        builtin = pipeline->compound == NULL && pipeline->processArgs[0] != NULL ? findBuiltin(pipeline->processArgs[0]) : NULL;
+        if (pipeline->next == NULL && pipeline->compound == NULL && pipeline->processArgs[0] == NULL)
+        {
+            // only assignments, or words that expanded to nothing: the status is the one of the last substitution
+            if (!ranSubstitution)
+            {
+                lastExitStatus = 0;
+            }
+            if (job_type == fg && pipeline->assignments != NULL)
+            {
+                assignVariables(pipeline->assignments);
+            }
+        }
+        else if (pipeline->next == NULL && builtin != NULL && job_type == fg)
+        {
+            lastExitStatus = runBuiltin(builtin, pipeline);
+        }
+        else if (tail && job_type == fg && pipeline->next == NULL && pipeline->compound == NULL &&
+                 builtin == NULL && !hasPendingJobs())
+        {
+            // nothing is left to do after this command: it replaces the shell, which saves a fork and a wait
+            lastExitStatus = tailExec(pipeline);
+        }
+        else
+        {
+            executeParsedCommand(pipeline, job_type);
+        }
+    }
+
+    if (node->timed)
+    {
+        struct timespec endTime;
+        struct rusage shellEnd;
+        struct rusage total;
+        struct processList *proc;
+
+        clock_gettime(CLOCK_MONOTONIC, &endTime);
+        getrusage(RUSAGE_SELF, &shellEnd);
+        // whatever the shell itself spent (a builtin, starting the stages) counts as well
+        memset(&total, 0, sizeof(struct rusage));
+        timersub(&shellEnd.ru_utime, &shellStart.ru_utime, &total.ru_utime);
+        timersub(&shellEnd.ru_stime, &shellStart.ru_stime, &total.ru_stime);
+        total.ru_nvcsw = shellEnd.ru_nvcsw - shellStart.ru_nvcsw;
+        total.ru_nivcsw = shellEnd.ru_nivcsw - shellStart.ru_nivcsw;
+        if (pipeline == NULL)
+        {
+            // a compound command ran in the shell: count every child it waited for
+            struct rusage childrenEnd;
+
+            getrusage(RUSAGE_CHILDREN, &childrenEnd);
+            timersub(&childrenEnd.ru_utime, &childrenStart.ru_utime, &childrenEnd.ru_utime);
+            timersub(&childrenEnd.ru_stime, &childrenStart.ru_stime, &childrenEnd.ru_stime);
+            childrenEnd.ru_nvcsw -= childrenStart.ru_nvcsw;
+            childrenEnd.ru_nivcsw -= childrenStart.ru_nivcsw;
+            addUsage(&total, &childrenEnd);
+        }
+        if (pipeline == NULL || pipeline->cpid <= 0)
+        {
+            total.ru_maxrss = shellEnd.ru_maxrss > total.ru_maxrss ? shellEnd.ru_maxrss : total.ru_maxrss;
+        }
+        for (proc = pipeline; proc != NULL; proc = proc->next)
+        {
+            addUsage(&total, &proc->usage);
+        }
+        printTimeReport(endTime.tv_sec - startTime.tv_sec + (endTime.tv_nsec - startTime.tv_nsec) / 1e9, &total);
+    }
+
+    if (interactive && job_type == fg && lastExitStatus == 128 + SIGINT)
+    {
+        // ^C stops the whole command line, not just the current pipeline of a loop
+        interrupted = true;
+    }
+    rootProcess = NULL;
+    arenaRestore(&lineArena, mark);
+    return lastExitStatus;
+}
+
+/** This function runs an and-or list or a compound command in the background. A single pipeline becomes a job
+ * directly; anything else is run by a forked copy of the shell without job control, which the job table tracks
+ * as a single stage job**/
+int runBackgroundNode(struct astNode *node)
+{
+    struct processList process;
+    pid_t pid;
+
+    if (node->left->type == NODE_PIPELINE && !node->left->timed)
+    {
+        return runPipelineNode(node->left, bg);
+    }
+
+    fflush(stdout);
+    pid = fork();
+    if (pid < 0)
+    {
+        perror("yash: fork");
+        lastExitStatus = 1;
+        return lastExitStatus;
+    }
+    if (pid == 0)
+    {
+        // a timed pipeline in the background is timed by the copy of the shell running it
+        prepareChild(0);
+        interactive = false;
+        tailPosition = true;
+        executeNode(node->left);
+        fflush(stdout);
+        if (traceEnabled)
+        {
+            flushTrace();
+        }
+        _exit(lastExitStatus);
+    }
+
+    if (interactive)
+    {
+        setpgid(pid, pid);
+    }
+    memset(&process, 0, sizeof(struct processList));
+    process.processString = node->text;
+    process.cpid = pid;
+    process.groupId = pid;
+    addJob(&process, RUNNING);
+    lastExitStatus = 0;
+    return lastExitStatus;
+}
+
+/** This function runs a while or until loop: the body runs as long as the condition succeeds (while) or fails
+ * (until). The status is the one of the last body run, or 0 if it never ran**/
+int runLoop(struct astNode *node)
+{
+    int status = 0;
+
+    loopDepth++;
+    while (1)
+    {
+        executeNode(node->left);
+        if (listAborted())
+        {
+            if (endLoop())
+            {
+                break;
+            }
+            continue;
+        }
+        if ((lastExitStatus == 0) != (node->type == NODE_WHILE))
+        {
+            break;
+        }
+        executeNode(node->right);
+        status = lastExitStatus;
+        if (endLoop())
+        {
+            break;
+        }
+    }
+    loopDepth--;
+    lastExitStatus = status;
+    return lastExitStatus;
+}
+
+/** This function runs a for loop: the shell variable is set to every word in turn and the body is run**/
+int runFor(struct astNode *node)
+{
+    struct arenaMark mark = arenaSave(&lineArena);
+    char **words = node->words;
+    int wordCount = node->wordCount;
+    int status = 0;
+    int index;
+
+    if (node->expand)
+    {
+        words = expandWords(node->words, &wordCount);
+    }
+    loopDepth++;
+    for (index = 0; index < wordCount; index++)
+    {
+        setVariable(node->name, words[index], false);
+        executeNode(node->right);
+        status = lastExitStatus;
+        if (endLoop())
+        {
+            break;
+        }
+    }
+    loopDepth--;
+    arenaRestore(&lineArena, mark);
+    lastExitStatus = status;
+    return lastExitStatus;
+}
+
+/** This function runs a node of the syntax tree and returns its exit status. A pipeline after && only runs if the
+ * status so far is 0 and one after || only if it is not; a skipped pipeline is never started and leaves the status
+ * alone, so "false && a || b" runs b**/
+int executeNode(struct astNode *node)
+{
+    bool tail = tailPosition;
+
+    // only what runs last keeps the tail position, a condition or a loop body never has it
+    tailPosition = false;
+    switch (node->type)
+    {
+    case NODE_SEQUENCE:
+        for (; node != NULL && !listAborted(); node = node->right)
+        {
+            tailPosition = tail && node->right == NULL;
+            executeNode(node->left);
+        }
+        break;
+    case NODE_AND:
+        if (executeNode(node->left) == 0 && !listAborted())
+        {
+            tailPosition = tail;
+            executeNode(node->right);
+        }
+        break;
+    case NODE_OR:
+        if (executeNode(node->left) != 0 && !listAborted())
+        {
+            tailPosition = tail;
+            executeNode(node->right);
+        }
+        break;
+    case NODE_BACKGROUND:
+        runBackgroundNode(node);
+        break;
+    case NODE_PIPELINE:
+        tailPosition = tail;
+        runPipelineNode(node, fg);
+        break;
+    case NODE_IF:
+        executeNode(node->left);
+        if (listAborted())
+        {
+            break;
+        }
+        tailPosition = tail;
+        if (lastExitStatus == 0)
+        {
+            executeNode(node->right);
+        }
+        else if (node->elseBranch != NULL)
+        {
+            executeNode(node->elseBranch);
+        }
+        else
+        {
+            lastExitStatus = 0;
+        }
+        break;
+    case NODE_WHILE:
+    case NODE_UNTIL:
+        runLoop(node);
+        break;
+    case NODE_FOR:
+        runFor(node);
+        break;
+    }
+    tailPosition = false;
+    return lastExitStatus;
+}
+
+/** The break builtin: break [n] leaves the n innermost loops**/
+int breakCommand(char **args)
+{
+    int levels = args[1] != NULL ? atoi(args[1]) : 1;
+
+    if (levels < 1)
+    {
+        fprintf(stderr, "yash: break: %s: loop count out of range\n", args[1]);
+        return 1;
+    }
+    if (loopDepth == 0)
+    {
+        fprintf(stderr, "yash: break: only meaningful in a `for', `while', or `until' loop\n");
+        return 0;
+    }
+    breakLevels = levels < loopDepth ? levels : loopDepth;
+    return 0;
+}
+
+/** The continue builtin: continue [n] goes on with the next iteration of the n-th innermost loop**/
+int continueCommand(char **args)
+{
+    int levels = args[1] != NULL ? atoi(args[1]) : 1;
+
+    if (levels < 1)
+    {
+        fprintf(stderr, "yash: continue: %s: loop count out of range\n", args[1]);
+        return 1;
+    }
+    if (loopDepth == 0)
+    {
+        fprintf(stderr, "yash: continue: only meaningful in a `for', `while', or `until' loop\n");
+        return 0;
+    }
+    continueLevels = levels < loopDepth ? levels : loopDepth;
+    return 0;
+}
+
+/**This function parses the text (or takes its syntax tree from the cache) and runs it. Returns the exit status,
+ * or INPUT_INCOMPLETE without running anything if the text ends in the middle of a command and final is not set**/
+int parsecommands(char *inString, bool final)
+{
+    int result;
+    struct astNode *ast = parseSource(inString, final, &result);
+
+    return runParsedCommands(ast, result);
+}
+
+/** This function runs the syntax tree that parseSource returned with the result, and returns like parsecommands**/
+int runParsedCommands(struct astNode *ast, int result)
+{
+    if (result == INPUT_INCOMPLETE)
+    {
+        return INPUT_INCOMPLETE;
+    }
+    if (result != 0)
+    {
+        lastExitStatus = result;
+        return lastExitStatus;
+    }
+    if (ast == NULL)
+    {
+        return lastExitStatus;
     }
 
-    return parentProcess;
+    if (executionDepth == 0)
+    {
+        interrupted = false;
+        breakLevels = 0;
+        continueLevels = 0;
+    }
+    executionDepth++;
+    executeNode(ast);
+    executionDepth--;
+    return lastExitStatus;
 }
 
-/** This function returns count of process currenlty in execution**/
-int getProcessCount()
+/** This function opens the history file, $YASH_HISTFILE or ~/.yash_history, for appending and binds the history
+ * keys of the line editor to the functions below. The file is only mapped and indexed when history is first used,
+ * so a large history does not slow down the start of the shell**/
+void openHistory()
 {
-    int count = 0;
-    struct processList *processObj = (struct processList *)
-        malloc(sizeof(struct processList));
+    const char *path = getVariable("YASH_HISTFILE");
+    char defaultPath[PATH_MAX];
 
-    for (processObj = rootProcess; processObj != NULL; processObj = processObj->next)
+    if (path == NULL)
     {
-        count++;
+        const char *home = getVariable("HOME");
+        if (home == NULL)
+        {
+            return;
+        }
+        snprintf(defaultPath, sizeof(defaultPath), "%s/.yash_history", home);
+        path = defaultPath;
+    }
+    if (*path == '\0' || (historyFd = open(path, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, S_IRUSR | S_IWUSR)) < 0)
+    {
+        return;
     }
 
-    return count;
+    rl_bind_keyseq("\\C-p", historyPrevious);
+    rl_bind_keyseq("\\e[A", historyPrevious);
+    rl_bind_keyseq("\\eOA", historyPrevious);
+    rl_bind_keyseq("\\C-n", historyNext);
+    rl_bind_keyseq("\\e[B", historyNext);
+    rl_bind_keyseq("\\eOB", historyNext);
+    rl_bind_keyseq("\\C-r", historySearchBackward);
 }
 
-/**This function executes the parsed command by using fork and execvp; This function accepts the job type
- * as a parameter and runs the command
- * in foreground or background mode depending on that**/
-int exexuteCommands(struct processList *rootProcess, int infd, int outfd, int job_type)
+/** This function brings the mapping of the history file up to date with what this and other shells have appended
+ * since the last call and indexes the new entries. Entries are NUL-terminated; one that another shell is still
+ * writing has no NUL yet and is left for the next call. Returns false if the history is not available**/
+bool refreshHistory()
 {
+    struct stat sb;
+    size_t size;
+    char *entryEnd;
 
-    int status = 0;
-
-    cpid = fork();
-
-    if (cpid < 0)
+    if (historyFd < 0 || fstat(historyFd, &sb) < 0)
+    {
+        return false;
+    }
+    size = (size_t)sb.st_size;
+    if (size < historyMapSize)
+    {
+        // the file was truncated, index it again from the start
+        munmap(historyMap, historyMapSize);
+        historyMap = NULL;
+        historyMapSize = 0;
+        historyCount = 0;
+        historyIndexed = 0;
+    }
+    if (size == historyMapSize)
     {
+        return true;
+    }
 
-        return -1;
+    char *map = historyMap == NULL ? mmap(NULL, size, PROT_READ, MAP_SHARED, historyFd, 0)
+                                   : mremap(historyMap, historyMapSize, size, MREMAP_MAYMOVE);
+    if (map == MAP_FAILED)
+    {
+        return historyMap != NULL;
     }
+    historyMap = map;
+    historyMapSize = size;
 
-    if (cpid == 0)
+    while (historyIndexed < historyMapSize &&
+           (entryEnd = (char *)memchr(historyMap + historyIndexed, '\0', historyMapSize - historyIndexed)) != NULL)
     {
-        // child process
+        if (historyCount == historyCapacity)
+        {
+            historyCapacity = historyCapacity == 0 ? HISTORY_INDEX_MIN_SIZE : historyCapacity * 2;
+            historyIndex = (size_t *)realloc(historyIndex, sizeof(size_t) * historyCapacity);
+        }
+        historyIndex[historyCount++] = historyIndexed;
+        historyIndexed = entryEnd - historyMap + 1;
+    }
+    return true;
+}
 
-        // signal(SIGINT, SIG_DFL);
+/** This function appends a command to the history file. The entry goes out in a single O_APPEND write, so the
+ * entries of shells sharing the file never interleave. A command equal to the newest entry is not added again**/
+void addHistory(const char *text)
+{
+    size_t length = strlen(text);
+    const char *scan;
 
-        signal(SIGINT, SIG_DFL);
-        signal(SIGQUIT, SIG_DFL);
-        signal(SIGTSTP, SIG_DFL);
-        signal(SIGTTIN, SIG_DFL);
-        signal(SIGTTOU, SIG_DFL);
-        signal(SIGCHLD, SIG_DFL);
+    for (scan = text; *scan == ' ' || *scan == '\t' || *scan == '\n'; scan++)
+    {
+    }
+    if (*scan == '\0' || !refreshHistory())
+    {
+        return;
+    }
+    if (historyCount > 0 && strcmp(historyMap + historyIndex[historyCount - 1], text) == 0)
+    {
+        return;
+    }
+    if (write(historyFd, text, length + 1) != (ssize_t)(length + 1))
+    {
+        perror("yash: history");
+    }
+}
+
+/** This function returns the history entry that holds the byte at the offset of the history file, by binary
+ * search over the entry index**/
+size_t findHistoryEntry(size_t offset)
+{
+    size_t low = 0;
+    size_t high = historyCount;
 
-        rootProcess->cpid = getpid();
-        if (rootProcess->groupId > 0)
+    while (high - low > 1)
+    {
+        size_t middle = low + (high - low) / 2;
+        if (historyIndex[middle] <= offset)
         {
-            setpgid(0, rootProcess->groupId);
+            low = middle;
         }
         else
         {
-            rootProcess->groupId = rootProcess->cpid;
-            setpgid(0, rootProcess->groupId);
+            high = middle;
         }
+    }
+    return low;
+}
 
-        if (infd != 0)
-        {
-
-            dup2(infd, STDIN_FILENO);
+/** This function shows the history entry in the line editor. Moving away from the line being edited keeps a copy
+ * of it, which comes back when moving past the newest entry**/
+void showHistoryEntry(size_t entry, size_t point)
+{
+    if (historyEditLine == NULL)
+    {
+        historyEditLine = strndup(rl_line_buffer, rl_end);
+    }
+    historyPosition = entry;
+    rl_replace_line(historyMap + historyIndex[entry], 0);
+    rl_point = point > (size_t)rl_end ? rl_end : (int)point;
+}
 
-            close(infd);
-        }
-        if (outfd != 1)
+/** Line editor command for the up arrow and C-p: shows the previous history entry**/
+int historyPrevious(int count, int key)
+{
+    if (historyEditLine == NULL)
+    {
+        // entries appended by other shells are picked up each time the user starts to walk the history
+        if (!refreshHistory())
         {
+            rl_ding();
+            return 0;
+        }
+        historyPosition = historyCount;
+    }
+    if (historyPosition == 0)
+    {
+        rl_ding();
+        return 0;
+    }
+    showHistoryEntry(historyPosition - 1, (size_t)-1);
+    return 0;
+}
 
-            dup2(outfd, STDOUT_FILENO);
+/** Line editor command for the down arrow and C-n: shows the next history entry, or the line that was being edited
+ * after the newest entry**/
+int historyNext(int count, int key)
+{
+    if (historyEditLine == NULL)
+    {
+        rl_ding();
+        return 0;
+    }
+    if (historyPosition + 1 < historyCount)
+    {
+        showHistoryEntry(historyPosition + 1, (size_t)-1);
+        return 0;
+    }
+    rl_replace_line(historyEditLine, 0);
+    rl_point = rl_end;
+    free(historyEditLine);
+    historyEditLine = NULL;
+    return 0;
+}
 
-            close(outfd);
-        }
+/** Line editor command for C-r: shows the newest history entry containing the text typed so far, with the cursor
+ * on the match. Pressing C-r again goes on to older matches. The search runs backwards over the mapped file in
+ * windows with memmem and finds the entry of a match through the index, so it costs no walk over the entries**/
+int historySearchBackward(int count, int key)
+{
+    size_t queryLength;
+    size_t end;
+    size_t windowStart;
+    const char *match = NULL;
 
-        if (execvp(rootProcess->processArgs[0], rootProcess->processArgs) < 0)
+    if (rl_last_func != historySearchBackward)
+    {
+        free(historySearchText);
+        historySearchText = strndup(rl_line_buffer, rl_end);
+        if (!refreshHistory())
         {
-            exit(0);
+            rl_ding();
+            return 0;
         }
-        exit(0);
+        historySearchEnd = historyIndexed;
     }
-    else
+    queryLength = strlen(historySearchText);
+    if (queryLength == 0)
     {
+        return historyPrevious(count, key);
+    }
 
-        // parent process
+    end = historySearchEnd;
+    while (end >= queryLength && match == NULL)
+    {
+        const char *found;
 
-        rootProcess->cpid = cpid;
-        if (rootProcess->groupId > 0)
+        windowStart = end > HISTORY_SEARCH_WINDOW + queryLength ? end - HISTORY_SEARCH_WINDOW - queryLength : 0;
+        for (found = memmem(historyMap + windowStart, end - windowStart, historySearchText, queryLength); found != NULL;
+             found = memmem(found + 1, historyMap + end - found - 1, historySearchText, queryLength))
         {
-            setpgid(cpid, rootProcess->groupId);
+            match = found;
         }
-        else
+        if (windowStart == 0)
         {
-            rootProcess->groupId = rootProcess->cpid;
-            setpgid(cpid, rootProcess->cpid);
+            break;
         }
+        // the windows overlap by the length of the query, so a match on the border is not missed
+        end = windowStart + queryLength;
+    }
+    if (match == NULL)
+    {
+        rl_ding();
+        return 0;
+    }
 
-        if (job_type == fg)
-        {
-            tcsetpgrp(0, rootProcess->groupId);
+    size_t entry = findHistoryEntry(match - historyMap);
+    // the query holds no NUL, so the match never spans two entries
+    historySearchEnd = historyIndex[entry];
+    showHistoryEntry(entry, match - historyMap - historyIndex[entry]);
+    return 0;
+}
 
-            int waitid = -1;
-            int waitCount = 0;
-            int processCount = getProcessCount();
-            do
-            {
-                waitid = waitpid(-rootProcess->groupId, &wstatus, WUNTRACED);
-                waitCount++;
-                if (WIFSTOPPED(wstatus))
-                {
-                    pushJob(&rootJob, rootProcess->cpid, rootProcess->processString, STOPPED, ++globalJobNumber, rootProcess);
-                }
-            } while (waitCount < processCount);
-            waitid = status;
+/** This function checks if the command index has to be rebuilt: PATH is different or one of its directories was
+ * changed since it was read. A directory that could not be read is remembered with a negative time**/
+bool commandIndexStale(const char *path)
+{
+    int index = 0;
 
-            signal(SIGTTOU, SIG_IGN);
-            tcsetpgrp(0, getpid());
-            signal(SIGTTOU, SIG_DFL);
+    if (commandIndexPath == NULL || strcmp(commandIndexPath, path) != 0)
+    {
+        return true;
+    }
+    while (1)
+    {
+        const char *end = strchrnul(path, ':');
+        char dir[PATH_MAX];
+        struct stat info;
+
+        snprintf(dir, sizeof(dir), "%.*s", end == path ? 1 : (int)(end - path), end == path ? "." : path);
+        if (stat(dir, &info) < 0 ? commandIndexTimes[index].tv_sec != -1
+                                 : info.st_mtim.tv_sec != commandIndexTimes[index].tv_sec ||
+                                       info.st_mtim.tv_nsec != commandIndexTimes[index].tv_nsec)
+        {
+            return true;
         }
-        else if (job_type == bg)
+        if (*end == '\0')
         {
-
-            pushJob(&rootJob, rootProcess->cpid, rootProcess->processString, RUNNING, ++globalJobNumber, rootProcess);
+            return false;
         }
+        path = end + 1;
+        index++;
     }
-    return status;
 }
 
-/**This function sets the input/output/pipe  parameter before execution**/
-int executeParsedCommand(struct processList *rootProcess, int job_type)
+/** This function builds the sorted index of command names used for completion: the builtins and every executable
+ * file in the PATH directories, each name once. The names are packed in one block. A directory read in the clock tick
+ * it was changed in gets no time, so the next completion reads it again**/
+void buildCommandIndex(const char *path)
 {
-    struct processList *proc;
-    int status = 0;
-    int pipefd[2];
-    int infd = 0;
-    int outfd = 1;
-    pipe(pipefd);
-    while (rootProcess != NULL)
+    struct textBuffer names = {NULL, 0, 0};
+    size_t *offsets = NULL;
+    size_t offsetCapacity = 0;
+    int count = 0;
+    int dirs = 1;
+    int index;
+    const char *dir;
+
+    for (dir = path; *dir != '\0'; dir++)
     {
-        if (rootProcess->inputPath != NULL)
+        dirs += *dir == ':';
+    }
+    free(commandIndexTimes);
+    commandIndexTimes = (struct timespec *)malloc(sizeof(struct timespec) * dirs);
+
+    for (index = 0, dir = path;; index++)
+    {
+        const char *end = strchrnul(dir, ':');
+        struct directoryListing *listing;
+        char dirPath[PATH_MAX];
+        const char *entry;
+        int entryIndex;
+        int dirFd;
+
+        snprintf(dirPath, sizeof(dirPath), "%.*s", end == dir ? 1 : (int)(end - dir), end == dir ? "." : dir);
+        commandIndexTimes[index].tv_sec = -1;
+        commandIndexTimes[index].tv_nsec = 0;
+        if ((listing = readDirectory(dirPath)) != NULL &&
+            (dirFd = open(dirPath, O_PATH | O_DIRECTORY | O_CLOEXEC)) >= 0)
         {
-            if ((infd = open(rootProcess->inputPath, O_RDONLY)) < 0)
+            bool settled = listing->mtime.tv_sec < listing->scanned.tv_sec ||
+                           (listing->mtime.tv_sec == listing->scanned.tv_sec &&
+                            listing->mtime.tv_nsec < listing->scanned.tv_nsec);
+
+            if (settled)
             {
-                fprintf(stderr, "error opening file\n");
+                commandIndexTimes[index] = listing->mtime;
             }
-        }
-
-        if (rootProcess->outputPath != NULL)
-        {
-            outfd = 1;
-            outfd = open(rootProcess->outputPath, O_CREAT | O_WRONLY, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
-            if (outfd < 0)
+            else
             {
-                outfd = 1;
+                commandIndexTimes[index].tv_sec = -2;
             }
-            pipefd[1] = outfd;
-        }
+            for (entry = listing->names, entryIndex = 0; entryIndex < listing->count; entryIndex++)
+            {
+                unsigned char type = (unsigned char)entry[0];
+                const char *name = entry + 1;
+                size_t nameLength = strlen(name);
+                struct stat info;
 
-        if (rootProcess->next == NULL)
+                entry = name + nameLength + 1;
+                if (type == DT_DIR || (type != DT_REG && type != DT_LNK && type != DT_UNKNOWN) ||
+                    fstatat(dirFd, name, &info, 0) < 0 || !S_ISREG(info.st_mode) ||
+                    (info.st_mode & (S_IXUSR | S_IXGRP | S_IXOTH)) == 0)
+                {
+                    continue;
+                }
+                if ((size_t)count >= offsetCapacity)
+                {
+                    offsetCapacity = offsetCapacity == 0 ? 1024 : offsetCapacity * 2;
+                    offsets = (size_t *)realloc(offsets, sizeof(size_t) * offsetCapacity);
+                }
+                offsets[count++] = names.length;
+                appendText(&names, name, nameLength + 1);
+            }
+            close(dirFd);
+        }
+        if (*end == '\0')
         {
-            status = exexuteCommands(rootProcess, infd, outfd, job_type);
+            break;
         }
-        else if (rootProcess->next != NULL)
+        dir = end + 1;
+    }
+    for (index = 0; index < (int)(sizeof(builtins) / sizeof(builtins[0])); index++)
+    {
+        if ((size_t)count >= offsetCapacity)
         {
-
-            status = exexuteCommands(rootProcess, infd, pipefd[1], 2);
-            close(pipefd[1]);
-            infd = pipefd[0];
+            offsetCapacity = offsetCapacity == 0 ? 1024 : offsetCapacity * 2;
+            offsets = (size_t *)realloc(offsets, sizeof(size_t) * offsetCapacity);
         }
+        offsets[count++] = names.length;
+        appendText(&names, builtins[index].name, strlen(builtins[index].name) + 1);
+    }
 
-        rootProcess = rootProcess->next;
+    // the offsets become pointers once the block stops moving
+    free(commandIndex);
+    free(commandIndexNames);
+    commandIndexNames = names.data;
+    commandIndex = (char **)malloc(sizeof(char *) * (count + 1));
+    for (index = 0; index < count; index++)
+    {
+        commandIndex[index] = commandIndexNames + offsets[index];
+    }
+    qsort(commandIndex, count, sizeof(char *), compareFields);
+    commandIndexCount = 0;
+    for (index = 0; index < count; index++)
+    {
+        if (commandIndexCount == 0 || strcmp(commandIndex[commandIndexCount - 1], commandIndex[index]) != 0)
+        {
+            commandIndex[commandIndexCount++] = commandIndex[index];
+        }
     }
+    free(offsets);
+    free(commandIndexPath);
+    commandIndexPath = strdup(path);
+}
 
-    return status;
+/** This function checks if the word starting at start in the line being edited is in the place of a command name:
+ * first on the line, behind an operator, a reserved word that is followed by a command, or an assignment**/
+bool isCommandPosition(int start)
+{
+    static const char *commandWords[] = {"!", "do", "elif", "else", "if", "then", "time", "until", "while"};
+    const char *line = rl_line_buffer;
+    const char *equals;
+    int end;
+    size_t word;
+
+    while (start > 0 && (line[start - 1] == ' ' || line[start - 1] == '\t'))
+    {
+        start--;
+    }
+    if (start == 0 || strchr("|&;(\n", line[start - 1]) != NULL)
+    {
+        return true;
+    }
+    end = start;
+    while (start > 0 && strchr(" \t\n|&;(", line[start - 1]) == NULL)
+    {
+        start--;
+    }
+    for (word = 0; word < sizeof(commandWords) / sizeof(commandWords[0]); word++)
+    {
+        if (strlen(commandWords[word]) == (size_t)(end - start) && strncmp(line + start, commandWords[word], end - start) == 0)
+        {
+            return true;
+        }
+    }
+    equals = (const char *)memchr(line + start, '=', end - start);
+    if (equals != NULL && isValidName(line + start, equals - line - start))
+    {
+        return isCommandPosition(start);
+    }
+    return false;
 }
 
-/**This function executes shell commands like fg/bg/jobs**/
-void executeShellCommands(char *inString)
+/** Readline generator of the command names that start with text. The first call finds the first of them in the
+ * sorted index with a binary search, the following ones walk on from there**/
+char *completeCommand(const char *text, int state)
 {
-    char *command = strdup(inString);
-    if (strstr(inString, "fg"))
+    size_t length = strlen(text);
+
+    if (state == 0)
     {
+        int low = 0;
+        int high = commandIndexCount;
 
-        struct jobList *jobObj =
-            (struct jobList *)
-                malloc(sizeof(struct jobList));
-        if (!isEmpty(rootJob))
+        while (low < high)
         {
-            jobObj = popJob(&rootJob);
-            pid_t pid;
-            pid = jobObj->process->groupId;
+            int middle = low + (high - low) / 2;
 
-            usleep(100);
-            if (jobObj->jobStatus != RUNNING)
+            if (strcmp(commandIndex[middle], text) < 0)
             {
-                printf("%s\n", jobObj->jobCommand);
-                kill(-pid, SIGCONT);
+                low = middle + 1;
             }
             else
             {
-                printf("%s\n", jobObj->jobCommand);
+                high = middle;
             }
-            tcsetpgrp(0, pid);
-
-            int status = 0;
-
-            waitpid(pid, &status, WUNTRACED);
+        }
+        completionPosition = low;
+    }
+    if (completionPosition < commandIndexCount && strncmp(commandIndex[completionPosition], text, length) == 0)
+    {
+        return strdup(commandIndex[completionPosition++]);
+    }
+    return NULL;
+}
 
-            if (WSTOPSIG(status))
-            {
+/** Readline generator of the %N job specs that start with text**/
+char *completeJob(const char *text, int state)
+{
+    size_t length = strlen(text);
 
-                pushJob(&rootJob, jobObj->process->cpid, jobObj->jobCommand, STOPPED, jobObj->jobCount, jobObj->process);
-                // printf("[%d] %s %s\n", jobObj->jobCount, jobObj->jobSign, jobObj->jobCommand);
-            }
+    if (state == 0)
+    {
+        completionPosition = 1;
+    }
+    while (completionPosition <= globalJobNumber)
+    {
+        char spec[16];
 
-            signal(SIGTTOU, SIG_IGN);
-            tcsetpgrp(0, getpid());
-            signal(SIGTTOU, SIG_DFL);
+        if (jobTable[completionPosition++] == NULL)
+        {
+            continue;
+        }
+        snprintf(spec, sizeof(spec), "%%%d", completionPosition - 1);
+        if (strncmp(spec, text, length) == 0)
+        {
+            return strdup(spec);
         }
     }
-    else if (strstr(inString, "bg"))
+    return NULL;
+}
+
+/** Readline completion function. Job specs are completed from the job table and command names from the index of
+ * builtins and PATH, which is built on the first use and again only when PATH or one of its directories changes.
+ * Everything else, and commands given with a path, is left to readline's file name completion**/
+char **completeWord(const char *text, int start, int end)
+{
+    (void)end;
+    if (text[0] == '%')
+    {
+        rl_attempted_completion_over = 1;
+        return rl_completion_matches(text, completeJob);
+    }
+    if (strchr(text, '/') == NULL && isCommandPosition(start))
     {
+        const char *path = getVariable("PATH");
 
-        struct jobList *jobObj =
-            (struct jobList *)
-                malloc(sizeof(struct jobList));
+        if (path == NULL)
+        {
+            path = DEFAULT_PATH;
+        }
+        if (commandIndexStale(path))
+        {
+            buildCommandIndex(path);
+        }
+        rl_attempted_completion_over = 1;
+        return rl_completion_matches(text, completeCommand);
+    }
+    return NULL;
+}
 
-        jobObj = deleteJobByStatus(&rootJob, STOPPED);
+/** Readline callback for a complete input line. The line editor is taken down while the command runs so the
+ * command gets the terminal in its normal mode, and put back (printing the prompt) afterwards. A line that leaves
+ * a command unfinished (an open if/while/for, a quote, a trailing | or &&) is kept and the next line is added to it
+ * under the "> " prompt. Complete commands are appended to the history file**/
+void handleLine(char *inString)
+{
+    char *text = inString;
 
-        if (jobObj != NULL)
+    rl_callback_handler_remove();
+    if (inString == NULL)
+    {
+        if (pendingInput != NULL)
         {
-            int wpid = -1;
-            pid_t pid;
-            pid = jobObj->process->groupId;
+            fprintf(stderr, "yash: syntax error: unexpected end of file\n");
+            lastExitStatus = 2;
+        }
+        exit(lastExitStatus);
+    }
 
-            kill(-pid, SIGCONT);
-            usleep(100);
-            wpid = waitpid(-1, &wstatus, WUNTRACED | WCONTINUED);
-            if (WIFCONTINUED(wstatus))
-            {
+    if (pendingInput != NULL)
+    {
+        size_t pendingLength = strlen(pendingInput);
+        size_t lineLength = strlen(inString);
 
-                pushJob(&rootJob, jobObj->process->cpid, jobObj->jobCommand, RUNNING, jobObj->jobCount, jobObj->process);
-                printf("[%d] %s %s\n", jobObj->jobCount, jobObj->jobSign, jobObj->jobCommand);
-            }
-        }
+        text = (char *)arenaAlloc(&lineArena, pendingLength + lineLength + 2);
+        memcpy(text, pendingInput, pendingLength);
+        text[pendingLength] = '\n';
+        memcpy(text + pendingLength + 1, inString, lineLength + 1);
+        free(pendingInput);
+        pendingInput = NULL;
     }
-    else if (strstr(inString, "jobs"))
+
+    if (strlen(text) != 0)
     {
+        struct astNode *ast;
+        int result;
 
-        if (!isEmpty(rootJob))
-        {
-            assigbJobSign(&rootJob);
-            printJobs(rootJob);
-        }
-        else
+        TRACE(TRACE_LINE_READ, 0, 0, 0, strlen(text));
+        free(historyEditLine);
+        historyEditLine = NULL;
+        if ((ast = parseSource(text, false, &result)) == NULL && result == INPUT_INCOMPLETE)
         {
-            globalJobNumber = 0;
+            pendingInput = strdup(text);
+            free(inString);
+            arenaReset(&lineArena);
+            clearDirectoryCache();
+            rl_callback_handler_install("> ", handleLine);
+            return;
         }
+        // the command is recorded before it runs, so that one that ends the shell (exit) is kept too and other
+        // shells see a long running one at once
+        addHistory(text);
+        runParsedCommands(ast, result);
+        // everything run from the line lives in the arena, jobs that outlive it have copied what they need
+        rootProcess = NULL;
     }
-    else if (strstr(inString, "exit"))
+    arenaReset(&lineArena);
+    clearDirectoryCache();
+    free(inString);
+
+    reapChildren();
+    notifyDoneJobs(true);
+    if (traceEnabled)
     {
-        exit(0);
+        // batch the events of the line into one write while the user is looking at the prompt
+        flushTrace();
     }
+    rl_callback_handler_install("# ", handleLine);
 }
 
-/**This function checks if the given command is background command, if yes then
- * removes the & from the cmd string and set bg flag and then parse rest of the command by removing
- * spaces from the commands and collects token **/
-char **parsecommands(char *inString)
+/** This function runs the commands in a block of script text, the same way the prompt runs them: line by line,
+ * where a command that is not finished at the end of a line (an if/while/for, a quote, a trailing | or &&) takes
+ * the following lines as well. Only complete lines are run unless final is set, in which case a last line without
+ * a newline is run too. Returns the number of bytes consumed; a command still waiting for lines is not consumed**/
+size_t runScriptText(const char *text, size_t length, bool final)
 {
+    size_t start = 0;
+    size_t next = 0;
 
-    char *command = strdup(inString);
-    int job_type = fg;
-    char **parsedCommandsArray;
-    int status = 0;
-
-    if (inString[strlen(inString) - 1] == '&')
+    while (next < length)
     {
-        job_type = bg;
-        inString[strlen(inString) - 1] = '\0';
+        const char *newline = (const char *)memchr(text + next, '\n', length - next);
+        size_t end;
+
+        if (newline == NULL && !final)
+        {
+            break;
+        }
+        end = newline != NULL ? (size_t)(newline - text) : length;
+        next = newline != NULL ? end + 1 : length;
+
+        if (end != start)
+        {
+            TRACE(TRACE_LINE_READ, 0, 0, 0, end - start);
+            // the command text is copied out of the (read-only) script text to be terminated
+            char *line = (char *)arenaAlloc(&lineArena, end - start + 1);
+            int status;
+
+            memcpy(line, text + start, end - start);
+            line[end - start] = '\0';
+            if (!interactive && final)
+            {
+                size_t rest = next;
+
+                // blank lines behind the last command do not keep it from replacing the shell
+                while (rest < length && (text[rest] == '\n' || text[rest] == ' ' || text[rest] == '\t'))
+                {
+                    rest++;
+                }
+                tailPosition = rest >= length;
+            }
+            status = parsecommands(line, final && next >= length);
+            tailPosition = false;
+            rootProcess = NULL;
+            arenaReset(&lineArena);
+            clearDirectoryCache();
+            if (status == INPUT_INCOMPLETE)
+            {
+                continue;
+            }
+            reapChildren();
+            trimDoneJobs();
+        }
+        start = next;
     }
+    return start;
+}
+
+/** This function runs a script file. The file is mapped instead of read, so even a large script costs no copying
+ * beyond the line being parsed. Returns the exit status of the last command**/
+int runScriptFile(const char *path)
+{
+    struct stat sb;
+    char *text;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
 
-    if (checkIfShellCommands(inString) == 0)
+    if (fd < 0)
+    {
+        fprintf(stderr, "yash: %s: %s\n", path, strerror(errno));
+        return 127;
+    }
+    if (fstat(fd, &sb) < 0 || !S_ISREG(sb.st_mode))
+    {
+        // not a regular file (e.g. a fifo or /dev/stdin), read it as a stream
+        int status = runScriptStream(fd);
+        close(fd);
+        return status;
+    }
+    if (sb.st_size == 0)
     {
+        close(fd);
+        return 0;
+    }
 
-        executeShellCommands(inString);
+    text = (char *)mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (text == MAP_FAILED)
+    {
+        fprintf(stderr, "yash: %s: %s\n", path, strerror(errno));
+        return 126;
     }
-    else
+    madvise(text, sb.st_size, MADV_SEQUENTIAL);
+    runScriptText(text, sb.st_size, true);
+    munmap(text, sb.st_size);
+    return lastExitStatus;
+}
+
+/** This function runs the commands read from a pipe or other stream in large chunks; each complete line is run as
+ * soon as it has arrived. Returns the exit status of the last command**/
+int runScriptStream(int fd)
+{
+    size_t capacity = SCRIPT_READ_SIZE;
+    size_t length = 0;
+    char *buffer = (char *)malloc(capacity);
+
+    while (1)
     {
-        parsedCommandsArray = parseStringStrtok(inString, " ");
-        int index = 0;
-        while (parsedCommandsArray[index] != NULL)
+        ssize_t count;
+        size_t consumed;
+
+        if (capacity - length < SCRIPT_READ_SIZE / 2)
         {
-            index++;
+            // a single line longer than the buffer
+            capacity *= 2;
+            buffer = (char *)realloc(buffer, capacity);
         }
-        parsedCommandsArray[index] = 0;
-
-        rootProcess = parseStringforPipes(parsedCommandsArray);
-        rootProcess->processString = command;
-        // printList(rootProcess);
-
-        status = executeParsedCommand(rootProcess, job_type);
+        count = read(fd, buffer + length, capacity - length);
+        if (count < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            perror("yash: read");
+            break;
+        }
+        if (count == 0)
+        {
+            runScriptText(buffer, length, true);
+            break;
+        }
+        length += count;
+        consumed = runScriptText(buffer, length, false);
+        memmove(buffer, buffer + consumed, length - consumed);
+        length -= consumed;
     }
-    return parsedCommandsArray;
+    free(buffer);
+    return lastExitStatus;
 }
 
-int main()
+/** The main loop waits on the terminal and on the SIGCHLD signalfd at the same time, so background jobs are reaped
+ * as soon as they exit even while the shell sits at the prompt. yash -c 'commands', yash script and a stdin that is
+ * not a terminal run without the line editor and without job control, and exit with the status of the last
+ * command**/
+int main(int argc, char **argv)
 {
+    int status;
+
+    if (argc > 1 && strcmp(argv[1], "-c") == 0)
+    {
+        if (argc < 3)
+        {
+            fprintf(stderr, "yash: -c: option requires an argument\n");
+            return 2;
+        }
+        interactive = false;
+        initshell();
+        runScriptText(argv[2], strlen(argv[2]), true);
+        fflush(stdout);
+        return lastExitStatus;
+    }
+    if (argc > 1)
+    {
+        interactive = false;
+        initshell();
+        status = runScriptFile(argv[1]);
+        fflush(stdout);
+        return status;
+    }
+    if (!isatty(STDIN_FILENO))
+    {
+        interactive = false;
+        initshell();
+        status = runScriptStream(STDIN_FILENO);
+        fflush(stdout);
+        return status;
+    }
 
     initshell();
-    char *inString = (char *)malloc(sizeof(char) * 1000);
+    // the environment belongs to the variable store, readline must not set LINES and COLUMNS in it
+    rl_change_environment = 0;
+    rl_attempted_completion_function = completeWord;
+    rl_callback_handler_install("# ", handleLine);
+    openHistory();
 
-    while ((inString = readline("# ")))
+    while (1)
     {
+        struct pollfd fds[2];
 
-        if (strlen(inString) != 0)
+        fds[0].fd = STDIN_FILENO;
+        fds[0].events = POLLIN;
+        fds[1].fd = sigChildFd;
+        fds[1].events = POLLIN;
+        if (poll(fds, 2, -1) < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            perror("yash: poll");
+            exit(1);
+        }
+        if (fds[1].revents & POLLIN)
+        {
+            reapChildren();
+        }
+        if (fds[0].revents & (POLLIN | POLLHUP | POLLERR))
         {
-            parsecommands(inString);
+            rl_callback_read_char();
         }
     }
-}
\ No newline at end of file
+}
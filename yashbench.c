@@ -0,0 +1,545 @@
+/**
+ *Program Name: yashbench.c
+ *This program measures the overhead of the shell itself by driving yash through a pseudo terminal the way a user
+ *would: startup latency, foreground round trips, background launches, pipeline throughput and job resume latency.
+ *The results are printed as CSV (default) or JSON so they can be compared across changes.
+ *
+ *Usage: yashbench [-f csv|json] [-o file] [-s scale] [path to yash]
+ **/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <time.h>
+#include <pty.h>
+#include <termios.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#define OUTPUT_BUFFER_SIZE (1 << 20)
+#define DEFAULT_TIMEOUT 30.0
+
+struct session
+{
+    pid_t pid;
+    int fd;
+    char *output;
+    size_t length;
+    size_t cursor;
+};
+
+struct result
+{
+    const char *name;
+    double value;
+    const char *unit;
+    int iterations;
+};
+
+double now();
+bool startSession(struct session *session, const char *yashPath);
+void endSession(struct session *session);
+bool readOutput(struct session *session, double timeout);
+bool waitFor(struct session *session, const char *needle, double timeout);
+void sendInput(struct session *session, const char *input);
+bool waitMarker(struct session *session, int number);
+int compareDouble(const void *left, const void *right);
+void addResult(const char *name, double value, const char *unit, int iterations);
+void benchStartup(const char *yashPath, int iterations);
+void benchStartupCommand(const char *yashPath, int iterations);
+void benchForeground(const char *yashPath, const char *command, const char *name, int iterations);
+void benchBackground(const char *yashPath, int iterations);
+void benchPipeline(const char *yashPath, int stages, int megabytes);
+void benchResume(const char *yashPath, int iterations);
+void printResults(FILE *out, const char *format);
+
+struct result results[64];
+int resultCount = 0;
+int markerNumber = 0;
+
+/** This function returns the monotonic time in seconds**/
+double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/** This function starts yash on a new pseudo terminal and waits for its first prompt**/
+bool startSession(struct session *session, const char *yashPath)
+{
+    struct winsize size = {24, 200, 0, 0};
+
+    session->output = (char *)malloc(OUTPUT_BUFFER_SIZE);
+    session->length = 0;
+    session->cursor = 0;
+    session->fd = -1;
+    session->pid = forkpty(&session->fd, NULL, NULL, &size);
+    if (session->pid < 0)
+    {
+        perror("yashbench: forkpty");
+        return false;
+    }
+    if (session->pid == 0)
+    {
+        setenv("TERM", "dumb", 1);
+        setenv("INPUTRC", "/dev/null", 1);
+        execl(yashPath, yashPath, (char *)NULL);
+        perror("yashbench: exec");
+        _exit(127);
+    }
+    return waitFor(session, "# ", DEFAULT_TIMEOUT);
+}
+
+/** This function kills the shell and everything it started and releases the session**/
+void endSession(struct session *session)
+{
+    if (session->pid > 0)
+    {
+        kill(session->pid, SIGKILL);
+        waitpid(session->pid, NULL, 0);
+    }
+    if (session->fd >= 0)
+    {
+        close(session->fd);
+    }
+    free(session->output);
+}
+
+/** This function appends whatever the shell printed within the timeout to the session output. The buffer only keeps
+ * the text after the cursor once it fills up**/
+bool readOutput(struct session *session, double timeout)
+{
+    struct pollfd pfd = {session->fd, POLLIN, 0};
+    ssize_t count;
+
+    if (poll(&pfd, 1, (int)(timeout * 1000)) <= 0)
+    {
+        return false;
+    }
+    if (session->length + 4096 > OUTPUT_BUFFER_SIZE)
+    {
+        memmove(session->output, session->output + session->cursor, session->length - session->cursor);
+        session->length -= session->cursor;
+        session->cursor = 0;
+    }
+    count = read(session->fd, session->output + session->length, OUTPUT_BUFFER_SIZE - session->length - 1);
+    if (count <= 0)
+    {
+        return false;
+    }
+    session->length += count;
+    session->output[session->length] = '\0';
+    return true;
+}
+
+/** This function waits until the needle shows up in the output after the cursor and moves the cursor past it**/
+bool waitFor(struct session *session, const char *needle, double timeout)
+{
+    double deadline = now() + timeout;
+
+    while (1)
+    {
+        char *found;
+
+        if (session->length > session->cursor &&
+            (found = (char *)memmem(session->output + session->cursor, session->length - session->cursor, needle,
+                                    strlen(needle))) != NULL)
+        {
+            session->cursor = found - session->output + strlen(needle);
+            return true;
+        }
+        if (now() > deadline || !readOutput(session, deadline - now()))
+        {
+            if (now() > deadline)
+            {
+                fprintf(stderr, "yashbench: timed out waiting for \"%s\"\n", needle);
+            }
+            return false;
+        }
+    }
+}
+
+/** This function types the input into the terminal**/
+void sendInput(struct session *session, const char *input)
+{
+    size_t length = strlen(input);
+
+    while (length > 0)
+    {
+        ssize_t count = write(session->fd, input, length);
+        if (count < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return;
+        }
+        if (count == 0)
+        {
+            struct pollfd pfd = {session->fd, POLLOUT, 0};
+            poll(&pfd, 1, 100);
+        }
+        input += count;
+        length -= count;
+    }
+}
+
+/** This function makes the shell print a marker and waits for it. The marker is quoted on the command line so the
+ * echo of the typed line never matches, only the output of the command does**/
+bool waitMarker(struct session *session, int number)
+{
+    char command[64];
+    char needle[64];
+
+    snprintf(command, sizeof(command), "echo M'A'RK%d\n", number);
+    snprintf(needle, sizeof(needle), "MARK%d\r\n", number);
+    sendInput(session, command);
+    return waitFor(session, needle, DEFAULT_TIMEOUT);
+}
+
+/** Comparison function for sorting timings**/
+int compareDouble(const void *left, const void *right)
+{
+    double a = *(const double *)left;
+    double b = *(const double *)right;
+    return (a > b) - (a < b);
+}
+
+/** This function records one measurement**/
+void addResult(const char *name, double value, const char *unit, int iterations)
+{
+    if (resultCount < (int)(sizeof(results) / sizeof(results[0])))
+    {
+        results[resultCount].name = name;
+        results[resultCount].value = value;
+        results[resultCount].unit = unit;
+        results[resultCount].iterations = iterations;
+        resultCount++;
+    }
+}
+
+/** Startup to prompt: time from forkpty until the first prompt is on the terminal (median and p95)**/
+void benchStartup(const char *yashPath, int iterations)
+{
+    double *timings = (double *)malloc(sizeof(double) * iterations);
+    int index;
+    int done = 0;
+
+    for (index = 0; index < iterations; index++)
+    {
+        struct session session;
+        double start = now();
+
+        if (startSession(&session, yashPath))
+        {
+            timings[done++] = (now() - start) * 1000;
+        }
+        endSession(&session);
+    }
+    if (done > 0)
+    {
+        qsort(timings, done, sizeof(double), compareDouble);
+        addResult("startup_to_prompt_median", timings[done / 2], "ms", done);
+        addResult("startup_to_prompt_p95", timings[done * 95 / 100], "ms", done);
+    }
+    free(timings);
+}
+
+/** Non-interactive startup: fork, exec and wait for yash -c true, the path an orchestrator uses**/
+void benchStartupCommand(const char *yashPath, int iterations)
+{
+    double start = now();
+    int index;
+
+    for (index = 0; index < iterations; index++)
+    {
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            execl(yashPath, yashPath, "-c", "true", (char *)NULL);
+            _exit(127);
+        }
+        waitpid(pid, NULL, 0);
+    }
+    addResult("startup_command_mean", (now() - start) * 1000 / iterations, "ms", iterations);
+}
+
+/** Foreground round trip: a batch of the same command typed at the prompt, timed until a marker after the last
+ * one. true is a builtin and measures the prompt/parse path alone, /bin/true adds launching and reaping a process**/
+void benchForeground(const char *yashPath, const char *command, const char *name, int iterations)
+{
+    struct session session;
+    size_t length = strlen(command);
+    char *input = (char *)malloc(iterations * (length + 1) + 1);
+    double start;
+    int index;
+
+    if (!startSession(&session, yashPath))
+    {
+        endSession(&session);
+        free(input);
+        return;
+    }
+    for (index = 0; index < iterations; index++)
+    {
+        memcpy(input + index * (length + 1), command, length);
+        input[index * (length + 1) + length] = '\n';
+    }
+    input[iterations * (length + 1)] = '\0';
+
+    start = now();
+    sendInput(&session, input);
+    if (waitMarker(&session, ++markerNumber))
+    {
+        addResult(name, (now() - start) * 1e6 / iterations, "us", iterations);
+    }
+    endSession(&session);
+    free(input);
+}
+
+/** Background launch rate: true & typed repeatedly; the marker is printed once every job has been started, and
+ * the jobs are reaped by the shell's main loop**/
+void benchBackground(const char *yashPath, int iterations)
+{
+    struct session session;
+    char *input = (char *)malloc(iterations * 7 + 1);
+    double start;
+    int index;
+
+    if (!startSession(&session, yashPath))
+    {
+        endSession(&session);
+        free(input);
+        return;
+    }
+    for (index = 0; index < iterations; index++)
+    {
+        memcpy(input + index * 7, "true &\n", 7);
+    }
+    input[iterations * 7] = '\0';
+
+    start = now();
+    sendInput(&session, input);
+    if (waitMarker(&session, ++markerNumber))
+    {
+        // the time is taken once jobs has answered, so the reaping the shell has done by then is included
+        sendInput(&session, "jobs\n");
+        if (waitMarker(&session, ++markerNumber))
+        {
+            addResult("bg_launch_rate", iterations / (now() - start), "jobs/s", iterations);
+        }
+    }
+    endSession(&session);
+    free(input);
+}
+
+/** Pipeline throughput: megabytes of zeros pushed through the given number of stages (head plus cats)**/
+void benchPipeline(const char *yashPath, int stages, int megabytes)
+{
+    static char names[8][32];
+    static int nameCount = 0;
+    struct session session;
+    char command[512];
+    double start;
+    int index;
+    int length;
+
+    if (!startSession(&session, yashPath))
+    {
+        endSession(&session);
+        return;
+    }
+    length = snprintf(command, sizeof(command), "head -c %dM /dev/zero", megabytes);
+    for (index = 1; index < stages; index++)
+    {
+        length += snprintf(command + length, sizeof(command) - length, " | cat");
+    }
+    snprintf(command + length, sizeof(command) - length, " > /dev/null\n");
+
+    start = now();
+    sendInput(&session, command);
+    if (waitMarker(&session, ++markerNumber) && nameCount < 8)
+    {
+        snprintf(names[nameCount], sizeof(names[nameCount]), "pipeline_%d_stage_throughput", stages);
+        addResult(names[nameCount++], megabytes / (now() - start), "MB/s", 1);
+    }
+    endSession(&session);
+}
+
+/** Resume latency. fg: a stopped cat is brought back with fg and the time until it echoes a line typed right
+ * after is measured. bg: a stopped sleep is continued with bg and timed until the next prompt is usable**/
+void benchResume(const char *yashPath, int iterations)
+{
+    struct session session;
+    double fgTotal = 0;
+    double bgTotal = 0;
+    int fgDone = 0;
+    int bgDone = 0;
+    int index;
+
+    if (!startSession(&session, yashPath))
+    {
+        endSession(&session);
+        return;
+    }
+    sendInput(&session, "cat\n");
+    usleep(100000);
+    sendInput(&session, "\x1a");
+    waitFor(&session, "Stopped", DEFAULT_TIMEOUT);
+    for (index = 0; index < iterations; index++)
+    {
+        double start;
+        char line[32];
+        char needle[32];
+
+        waitMarker(&session, ++markerNumber);
+        snprintf(line, sizeof(line), "ping%d\n", index);
+        snprintf(needle, sizeof(needle), "ping%d\r\nping%d", index, index);
+        start = now();
+        sendInput(&session, "fg\n");
+        if (!waitFor(&session, "cat\r\n", DEFAULT_TIMEOUT))
+        {
+            break;
+        }
+        sendInput(&session, line);
+        if (!waitFor(&session, needle, DEFAULT_TIMEOUT))
+        {
+            break;
+        }
+        fgTotal += now() - start;
+        fgDone++;
+        sendInput(&session, "\x1a");
+        if (!waitFor(&session, "Stopped", DEFAULT_TIMEOUT))
+        {
+            break;
+        }
+    }
+    sendInput(&session, "kill -9 %1\n");
+    waitMarker(&session, ++markerNumber);
+
+    sendInput(&session, "sleep 1000\n");
+    usleep(100000);
+    sendInput(&session, "\x1a");
+    waitFor(&session, "Stopped", DEFAULT_TIMEOUT);
+    for (index = 0; index < iterations; index++)
+    {
+        double start;
+
+        waitMarker(&session, ++markerNumber);
+        start = now();
+        sendInput(&session, "bg\n");
+        if (!waitMarker(&session, ++markerNumber))
+        {
+            break;
+        }
+        bgTotal += now() - start;
+        bgDone++;
+        sendInput(&session, "kill -STOP %1\n");
+    }
+    sendInput(&session, "kill -9 %1\n");
+    waitMarker(&session, ++markerNumber);
+
+    if (fgDone > 0)
+    {
+        addResult("fg_resume_latency", fgTotal * 1000 / fgDone, "ms", fgDone);
+    }
+    if (bgDone > 0)
+    {
+        addResult("bg_resume_latency", bgTotal * 1000 / bgDone, "ms", bgDone);
+    }
+    endSession(&session);
+}
+
+/** This function prints the results as CSV or as a JSON array**/
+void printResults(FILE *out, const char *format)
+{
+    int index;
+
+    if (strcmp(format, "json") == 0)
+    {
+        fprintf(out, "[\n");
+        for (index = 0; index < resultCount; index++)
+        {
+            fprintf(out, "  {\"metric\": \"%s\", \"value\": %.3f, \"unit\": \"%s\", \"iterations\": %d}%s\n",
+                    results[index].name, results[index].value, results[index].unit, results[index].iterations,
+                    index + 1 < resultCount ? "," : "");
+        }
+        fprintf(out, "]\n");
+        return;
+    }
+    fprintf(out, "metric,value,unit,iterations\n");
+    for (index = 0; index < resultCount; index++)
+    {
+        fprintf(out, "%s,%.3f,%s,%d\n", results[index].name, results[index].value, results[index].unit,
+                results[index].iterations);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    const char *format = "csv";
+    const char *outputPath = NULL;
+    const char *yashPath = "./yash";
+    int scale = 1;
+    int option;
+    FILE *out = stdout;
+
+    while ((option = getopt(argc, argv, "f:o:s:")) != -1)
+    {
+        switch (option)
+        {
+        case 'f':
+            format = optarg;
+            break;
+        case 'o':
+            outputPath = optarg;
+            break;
+        case 's':
+            scale = atoi(optarg) > 0 ? atoi(optarg) : 1;
+            break;
+        default:
+            fprintf(stderr, "usage: yashbench [-f csv|json] [-o file] [-s scale] [yash]\n");
+            return 2;
+        }
+    }
+    if (optind < argc)
+    {
+        yashPath = argv[optind];
+    }
+    if (strcmp(format, "csv") != 0 && strcmp(format, "json") != 0)
+    {
+        fprintf(stderr, "yashbench: unknown format %s\n", format);
+        return 2;
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    benchStartup(yashPath, 50 * scale);
+    benchStartupCommand(yashPath, 200 * scale);
+    benchForeground(yashPath, "true", "fg_builtin_round_trip", 500 * scale);
+    benchForeground(yashPath, "/bin/true", "fg_exec_round_trip", 500 * scale);
+    benchBackground(yashPath, 500 * scale);
+    benchPipeline(yashPath, 2, 512 * scale);
+    benchPipeline(yashPath, 4, 512 * scale);
+    benchPipeline(yashPath, 8, 512 * scale);
+    benchResume(yashPath, 20 * scale);
+
+    if (outputPath != NULL && (out = fopen(outputPath, "w")) == NULL)
+    {
+        perror(outputPath);
+        return 1;
+    }
+    printResults(out, format);
+    if (out != stdout)
+    {
+        fclose(out);
+    }
+    return 0;
+}